@@ -1,6 +1,9 @@
 /** @file image_add.c
  */
 
+#include <math.h>
+#include <pthread.h>
+
 #include "CommandLineInterface/CLIcore.h"
 
 #include "COREMOD_memory/COREMOD_memory.h"
@@ -22,6 +25,21 @@ imageID basic_add3D(const char *__restrict ID_name1,
                     long off2,
                     long off3);
 
+imageID basic_add_inplace(const char *__restrict ID_name1,
+                          const char *__restrict ID_name2,
+                          long off1,
+                          long off2);
+
+imageID basic_mosaic(const char *__restrict tilelist,
+                     const char *__restrict ID_name_out,
+                     int normalize);
+
+imageID basic_add_shift(const char *__restrict ID_name1,
+                        const char *__restrict ID_name2,
+                        double off1,
+                        double off2,
+                        int kernel);
+
 // ==========================================
 // Command line interface wrapper function(s)
 // ==========================================
@@ -65,6 +83,58 @@ static errno_t image_basic_add3D_cli()
     }
 }
 
+static errno_t image_basic_add_inplace_cli()
+{
+    if(CLI_checkarg(1, 4) + CLI_checkarg(2, 4) + CLI_checkarg(3, 2) +
+            CLI_checkarg(4, 2) ==
+            0)
+    {
+        basic_add_inplace(data.cmdargtoken[1].val.string,
+                          data.cmdargtoken[2].val.string,
+                          data.cmdargtoken[3].val.numl,
+                          data.cmdargtoken[4].val.numl);
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+static errno_t image_basic_mosaic_cli()
+{
+    if(CLI_checkarg(1, 5) + CLI_checkarg(2, 3) + CLI_checkarg(3, 2) == 0)
+    {
+        basic_mosaic(data.cmdargtoken[1].val.string,
+                     data.cmdargtoken[2].val.string,
+                     data.cmdargtoken[3].val.numl);
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+static errno_t image_basic_add_shift_cli()
+{
+    if(CLI_checkarg(1, 4) + CLI_checkarg(2, 4) + CLI_checkarg(3, 1) +
+            CLI_checkarg(4, 1) + CLI_checkarg(5, 2) ==
+            0)
+    {
+        basic_add_shift(data.cmdargtoken[1].val.string,
+                        data.cmdargtoken[2].val.string,
+                        data.cmdargtoken[3].val.numf,
+                        data.cmdargtoken[4].val.numf,
+                        data.cmdargtoken[5].val.numl);
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
 // ==========================================
 // Register CLI command(s)
 // ==========================================
@@ -92,151 +162,731 @@ errno_t __attribute__((cold)) image_add_addCLIcmd()
                        "*ID_name2, const char *ID_name_out, long "
                        "off1, long off2, long off3)");
 
+    RegisterCLIcommand("addiminplace",
+                       __FILE__,
+                       image_basic_add_inplace_cli,
+                       "add 2D image into another, clipped to its bounds",
+                       "<im1 (modified)> <im2> <offsetx> <offsety>",
+                       "addiminplace im1 im2 23 201",
+                       "long basic_add_inplace(const char *ID_name1, const "
+                       "char *ID_name2, long off1, long off2)");
+
+    RegisterCLIcommand(
+        "immosaic",
+        __FILE__,
+        image_basic_mosaic_cli,
+        "weighted mosaic of 2D images",
+        "<tiles (im:offx:offy[:weight],...)> <outim> <normalize (0/1)>",
+        "immosaic im1:0:0,im2:200:0:0.5,im3:0:180 mos 1",
+        "long basic_mosaic(const char *tilelist, const char *ID_name_out, "
+        "int normalize)");
+
+    RegisterCLIcommand(
+        "addimshift",
+        __FILE__,
+        image_basic_add_shift_cli,
+        "add 2D image into another at sub-pixel offset",
+        "<im1 (modified)> <im2> <offsetx> <offsety> "
+        "<kernel (0:bilinear, 1:cubic, 2:Lanczos-3)>",
+        "addimshift sum frame 2.35 -0.7 1",
+        "long basic_add_shift(const char *ID_name1, const char *ID_name2, "
+        "double off1, double off2, int kernel)");
+
     return RETURN_SUCCESS;
 }
 
-imageID basic_add(const char *__restrict ID_name1,
-                  const char *__restrict ID_name2,
-                  const char *__restrict ID_name_out,
-                  long off1,
-                  long off2)
+// ==========================================
+// Type promotion and conversion kernels
+// ==========================================
+
+// real types, in kernel table order
+#define IMAGE_ADD_NBTYPE 10
+
+#define IMAGE_ADD_FOREACH_IN(K, TO)                                            \
+    K(TO, uint8_t)                                                             \
+    K(TO, int8_t)                                                              \
+    K(TO, uint16_t)                                                            \
+    K(TO, int16_t)                                                             \
+    K(TO, uint32_t)                                                            \
+    K(TO, int32_t)                                                             \
+    K(TO, uint64_t)                                                            \
+    K(TO, int64_t)                                                             \
+    K(TO, float)                                                               \
+    K(TO, double)
+
+#define IMAGE_ADD_FOREACH_OUT(K)                                               \
+    IMAGE_ADD_FOREACH_IN(K, uint8_t)                                           \
+    IMAGE_ADD_FOREACH_IN(K, int8_t)                                            \
+    IMAGE_ADD_FOREACH_IN(K, uint16_t)                                          \
+    IMAGE_ADD_FOREACH_IN(K, int16_t)                                           \
+    IMAGE_ADD_FOREACH_IN(K, uint32_t)                                          \
+    IMAGE_ADD_FOREACH_IN(K, int32_t)                                           \
+    IMAGE_ADD_FOREACH_IN(K, uint64_t)                                          \
+    IMAGE_ADD_FOREACH_IN(K, int64_t)                                           \
+    IMAGE_ADD_FOREACH_IN(K, float)                                             \
+    IMAGE_ADD_FOREACH_IN(K, double)
+
+typedef void (*IMAGE_ADD_KERNEL)(void       *out,
+                                 const void *in,
+                                 long        n,
+                                 int         accumulate);
+
+typedef void (*IMAGE_ADD_VECKERNEL)(void       *out,
+                                    const void *in1,
+                                    const void *in2,
+                                    long        n);
+
+// out = in (accumulate = 0) or out += in, converting TI to TO
+#define IMAGE_ADD_CONVERT(TO, TI)                                              \
+    static void image_add_convert_##TO##_##TI(                                 \
+        void *outv, const void *inv, long n, int accumulate)                   \
+    {                                                                          \
+        TO *__restrict       out = (TO *) outv;                                \
+        const TI *__restrict in  = (const TI *) inv;                           \
+        if(accumulate == 0)                                                    \
+        {                                                                      \
+            for(long ii = 0; ii < n; ii++)                                     \
+            {                                                                  \
+                out[ii] = (TO) in[ii];                                         \
+            }                                                                  \
+        }                                                                      \
+        else                                                                   \
+        {                                                                      \
+            for(long ii = 0; ii < n; ii++)                                     \
+            {                                                                  \
+                out[ii] += (TO) in[ii];                                        \
+            }                                                                  \
+        }                                                                      \
+    }
+
+// same, into the real part of a complex row of component type TO
+#define IMAGE_ADD_CONVERT_RE(TO, TI)                                           \
+    static void image_add_convert_re_##TO##_##TI(                              \
+        void *outv, const void *inv, long n, int accumulate)                   \
+    {                                                                          \
+        TO *__restrict       out = (TO *) outv;                                \
+        const TI *__restrict in  = (const TI *) inv;                           \
+        if(accumulate == 0)                                                    \
+        {                                                                      \
+            for(long ii = 0; ii < n; ii++)                                     \
+            {                                                                  \
+                out[2 * ii]     = (TO) in[ii];                                 \
+                out[2 * ii + 1] = 0;                                           \
+            }                                                                  \
+        }                                                                      \
+        else                                                                   \
+        {                                                                      \
+            for(long ii = 0; ii < n; ii++)                                     \
+            {                                                                  \
+                out[2 * ii] += (TO) in[ii];                                    \
+            }                                                                  \
+        }                                                                      \
+    }
+
+#define IMAGE_ADD_TABLEENTRY(TO, TI) image_add_convert_##TO##_##TI,
+#define IMAGE_ADD_TABLEENTRY_RE(TO, TI) image_add_convert_re_##TO##_##TI,
+
+IMAGE_ADD_FOREACH_OUT(IMAGE_ADD_CONVERT)
+IMAGE_ADD_FOREACH_IN(IMAGE_ADD_CONVERT_RE, float)
+IMAGE_ADD_FOREACH_IN(IMAGE_ADD_CONVERT_RE, double)
+
+// [output type][input type]
+static const IMAGE_ADD_KERNEL
+image_add_convert_table[IMAGE_ADD_NBTYPE][IMAGE_ADD_NBTYPE] =
 {
-    imageID ID1, ID2; /* ID for the 2 images added */
-    imageID ID_out;   /* ID for the output image */
-    long    ii, jj;
-    long    naxes1[2], naxes2[2], naxes[2];
-    long    xmin, ymin, xmax, ymax; /* extrema in the ID1 coordinates */
-    uint8_t datatype1, datatype2, datatype;
-    int     datatypeOK;
+    {IMAGE_ADD_FOREACH_IN(IMAGE_ADD_TABLEENTRY, uint8_t)},
+    {IMAGE_ADD_FOREACH_IN(IMAGE_ADD_TABLEENTRY, int8_t)},
+    {IMAGE_ADD_FOREACH_IN(IMAGE_ADD_TABLEENTRY, uint16_t)},
+    {IMAGE_ADD_FOREACH_IN(IMAGE_ADD_TABLEENTRY, int16_t)},
+    {IMAGE_ADD_FOREACH_IN(IMAGE_ADD_TABLEENTRY, uint32_t)},
+    {IMAGE_ADD_FOREACH_IN(IMAGE_ADD_TABLEENTRY, int32_t)},
+    {IMAGE_ADD_FOREACH_IN(IMAGE_ADD_TABLEENTRY, uint64_t)},
+    {IMAGE_ADD_FOREACH_IN(IMAGE_ADD_TABLEENTRY, int64_t)},
+    {IMAGE_ADD_FOREACH_IN(IMAGE_ADD_TABLEENTRY, float)},
+    {IMAGE_ADD_FOREACH_IN(IMAGE_ADD_TABLEENTRY, double)}
+};
 
-    ID1       = image_ID(ID_name1);
-    ID2       = image_ID(ID_name2);
-    naxes1[0] = data.image[ID1].md[0].size[0];
-    naxes1[1] = data.image[ID1].md[0].size[1];
-    naxes2[0] = data.image[ID2].md[0].size[0];
-    naxes2[1] = data.image[ID2].md[0].size[1];
+// [complex float, complex double][real input type]
+static const IMAGE_ADD_KERNEL image_add_convert_re_table[2][IMAGE_ADD_NBTYPE] =
+{
+    {IMAGE_ADD_FOREACH_IN(IMAGE_ADD_TABLEENTRY_RE, float)},
+    {IMAGE_ADD_FOREACH_IN(IMAGE_ADD_TABLEENTRY_RE, double)}
+};
 
-    datatype1 = data.image[ID1].md[0].datatype;
-    datatype2 = data.image[ID2].md[0].datatype;
+// out = in1 + in2, all of type T (first argument unused)
+#define IMAGE_ADD_VEC(X, T)                                                    \
+    static void image_add_vec_##T(void       *outv,                            \
+                                  const void *in1v,                            \
+                                  const void *in2v,                            \
+                                  long        n)                               \
+    {                                                                          \
+        T *__restrict       out = (T *) outv;                                  \
+        const T *__restrict in1 = (const T *) in1v;                            \
+        const T *__restrict in2 = (const T *) in2v;                            \
+        for(long ii = 0; ii < n; ii++)                                         \
+        {                                                                      \
+            out[ii] = in1[ii] + in2[ii];                                       \
+        }                                                                      \
+    }
 
-    datatypeOK = 0;
+#define IMAGE_ADD_VECENTRY(X, T) image_add_vec_##T,
 
-    if((datatype1 == _DATATYPE_FLOAT) && (datatype2 == _DATATYPE_FLOAT))
-    {
-        datatype   = _DATATYPE_FLOAT;
-        datatypeOK = 1;
+IMAGE_ADD_FOREACH_IN(IMAGE_ADD_VEC, )
+
+static const IMAGE_ADD_VECKERNEL image_add_vec_table[IMAGE_ADD_NBTYPE] = {
+    IMAGE_ADD_FOREACH_IN(IMAGE_ADD_VECENTRY, )
+};
+
+typedef void (*IMAGE_ADD_WKERNEL)(void       *out,
+                                  const void *in,
+                                  long        n,
+                                  double      weight);
+
+// out += weight * in, out of float type TO
+#define IMAGE_ADD_WACC(TO, TI)                                                 \
+    static void image_add_wacc_##TO##_##TI(                                    \
+        void *outv, const void *inv, long n, double weight)                    \
+    {                                                                          \
+        TO *__restrict       out = (TO *) outv;                                \
+        const TI *__restrict in  = (const TI *) inv;                           \
+        TO                   w   = (TO) weight;                                \
+        for(long ii = 0; ii < n; ii++)                                         \
+        {                                                                      \
+            out[ii] += w * (TO) in[ii];                                        \
+        }                                                                      \
     }
-    if((datatype1 == _DATATYPE_DOUBLE) && (datatype2 == _DATATYPE_DOUBLE))
+
+#define IMAGE_ADD_WACCENTRY(TO, TI) image_add_wacc_##TO##_##TI,
+
+IMAGE_ADD_FOREACH_IN(IMAGE_ADD_WACC, float)
+IMAGE_ADD_FOREACH_IN(IMAGE_ADD_WACC, double)
+
+// [float, double][real input type]
+static const IMAGE_ADD_WKERNEL image_add_wacc_table[2][IMAGE_ADD_NBTYPE] = {
+    {IMAGE_ADD_FOREACH_IN(IMAGE_ADD_WACCENTRY, float)},
+    {IMAGE_ADD_FOREACH_IN(IMAGE_ADD_WACCENTRY, double)}
+};
+
+#undef IMAGE_ADD_CONVERT
+#undef IMAGE_ADD_CONVERT_RE
+#undef IMAGE_ADD_TABLEENTRY
+#undef IMAGE_ADD_TABLEENTRY_RE
+#undef IMAGE_ADD_VEC
+#undef IMAGE_ADD_VECENTRY
+#undef IMAGE_ADD_WACC
+#undef IMAGE_ADD_WACCENTRY
+
+/* kernel table index of datatype (of its component for complex types)
+ * returns -1 if not supported
+ */
+static int image_add_typeindex(uint8_t datatype, int *iscomplex)
+{
+    *iscomplex = 0;
+    switch(datatype)
     {
-        datatype   = _DATATYPE_DOUBLE;
-        datatypeOK = 1;
+        case _DATATYPE_UINT8:
+            return 0;
+        case _DATATYPE_INT8:
+            return 1;
+        case _DATATYPE_UINT16:
+            return 2;
+        case _DATATYPE_INT16:
+            return 3;
+        case _DATATYPE_UINT32:
+            return 4;
+        case _DATATYPE_INT32:
+            return 5;
+        case _DATATYPE_UINT64:
+            return 6;
+        case _DATATYPE_INT64:
+            return 7;
+        case _DATATYPE_FLOAT:
+            return 8;
+        case _DATATYPE_DOUBLE:
+            return 9;
+        case _DATATYPE_COMPLEX_FLOAT:
+            *iscomplex = 1;
+            return 8;
+        case _DATATYPE_COMPLEX_DOUBLE:
+            *iscomplex = 1;
+            return 9;
     }
 
-    if(datatypeOK == 0)
+    return -1;
+}
+
+/* datatype of the sum of datatype1 and datatype2
+ *
+ * Same rules as numpy :
+ * - integers of same signedness : larger type
+ * - signed and unsigned : smallest signed type holding both, double for
+ *   uint64 with a signed type
+ * - integer and float : float up to 16 bit integers, double above
+ * - complex if either input is complex, with the precision of the result
+ *   of the real parts
+ *
+ * returns 0 if a datatype is not supported
+ */
+static uint8_t image_add_promote(uint8_t datatype1, uint8_t datatype2)
+{
+    // size [bytes] and signedness of integer types, by table index
+    static const int intsize[8]   = {1, 1, 2, 2, 4, 4, 8, 8};
+    static const int intsigned[8] = {0, 1, 0, 1, 0, 1, 0, 1};
+    // table index -> datatype
+    static const uint8_t dtype[IMAGE_ADD_NBTYPE] = {_DATATYPE_UINT8,
+                                                    _DATATYPE_INT8,
+                                                    _DATATYPE_UINT16,
+                                                    _DATATYPE_INT16,
+                                                    _DATATYPE_UINT32,
+                                                    _DATATYPE_INT32,
+                                                    _DATATYPE_UINT64,
+                                                    _DATATYPE_INT64,
+                                                    _DATATYPE_FLOAT,
+                                                    _DATATYPE_DOUBLE
+                                                   };
+    int c1, c2;
+    int i1 = image_add_typeindex(datatype1, &c1);
+    int i2 = image_add_typeindex(datatype2, &c2);
+    int i;
+
+    if((i1 == -1) || (i2 == -1))
     {
-        printf("ERROR in basic_add: data type combination not supported\n");
-        exit(EXIT_FAILURE);
+        return 0;
+    }
+    if(i1 > i2)
+    {
+        // i1 <= i2 below
+        int tmp = i1;
+        i1      = i2;
+        i2      = tmp;
     }
 
-    /*  if(data.quiet==0)*/
-    /* printf("add called with %s ( %ld x %ld ) %s ( %ld x %ld ) and offset ( %ld x %ld )\n",ID_name1,naxes1[0],naxes1[1],ID_name2,naxes2[0],naxes2[1],off1,off2);*/
-    xmin = 0;
-    if(off1 < 0)
+    if(i2 >= 8)
+    {
+        // at least one float
+        i = i2;
+        if((i1 < 8) && (intsize[i1] >= 4))
+        {
+            i = 9;
+        }
+    }
+    else if(intsigned[i1] == intsigned[i2])
+    {
+        i = i2;
+    }
+    else if(intsigned[i1] == 1)
+    {
+        // i1 signed, i2 unsigned and larger
+        i = (i2 == 6) ? 9 : i2 + 3;
+    }
+    else if(intsize[i2] > intsize[i1])
+    {
+        // i2 signed and larger
+        i = i2;
+    }
+    else
     {
-        xmin = off1;
+        // i1 unsigned, i2 signed of same size
+        i = (i2 == 7) ? 9 : i2 + 2;
     }
-    ymin = 0;
-    if(off2 < 0)
+
+    if((c1 == 1) || (c2 == 1))
     {
-        ymin = off2;
+        if(i < 8)
+        {
+            i = (intsize[i] >= 4) ? 9 : 8;
+        }
+        return (i == 8) ? _DATATYPE_COMPLEX_FLOAT : _DATATYPE_COMPLEX_DOUBLE;
     }
-    xmax = naxes1[0];
-    if((naxes2[0] + off1) > naxes1[0])
+
+    return dtype[i];
+}
+
+/* out = in (accumulate = 0) or out += in over n pixels, converting
+ * datatypein to datatypeout. datatypeout must be complex if datatypein is.
+ */
+static void image_add_convert(void       *out,
+                              uint8_t     datatypeout,
+                              const void *in,
+                              uint8_t     datatypein,
+                              long        n,
+                              int         accumulate)
+{
+    int cout, cin;
+    int iout = image_add_typeindex(datatypeout, &cout);
+    int iin  = image_add_typeindex(datatypein, &cin);
+
+    if((cout == 1) && (cin == 0))
     {
-        xmax = (naxes2[0] + off1);
+        image_add_convert_re_table[iout - 8][iin](out, in, n, accumulate);
     }
-    ymax = naxes1[1];
-    if((naxes2[1] + off2) > naxes1[1])
+    else
     {
-        ymax = (naxes2[1] + off2);
+        // complex to complex : real and imaginary parts as 2n values
+        image_add_convert_table[iout][iin](out,
+                                           in,
+                                           (cout == 1) ? 2 * n : n,
+                                           accumulate);
     }
+}
 
-    if(datatype == _DATATYPE_FLOAT)
+/* add plan : output box and the two input boxes placed in it
+ *
+ * Rows are split at the input edges once, for each combination of inputs
+ * present in a row. Each segment is then zeroed (no input), copied (one
+ * input, converted to the output datatype), or added.
+ */
+typedef struct
+{
+    char   *out;
+    uint8_t datatype;
+    size_t  typesize;
+    long    naxes[3];
+
+    const char *in[2];
+    uint8_t     datatypein[2];
+    size_t      typesizein[2];
+    long        naxesin[2][3];
+    long        pos[2][3]; // input origin in output coordinates
+
+    // row segments, indexed by inputs present in row (bit 0 : in[0])
+    int  NBseg[4];
+    long segstart[4][5];
+    long segend[4][5];
+    int  segcover[4][5]; // inputs covering segment, same bits
+} IMAGE_ADD_PLAN;
+
+typedef struct
+{
+    const IMAGE_ADD_PLAN *plan;
+    long                  rowstart; // row index kk * naxes[1] + jj
+    long                  rowend;
+} IMAGE_ADD_THREAD;
+
+// max number of threads
+#define IMAGE_ADD_MAXTHREAD 64
+
+// min output pixels per thread
+#define IMAGE_ADD_MINTHREADPIX (256L * 1024)
+
+// plan row segments for each combination of inputs present
+static void image_add_plansegments(IMAGE_ADD_PLAN *plan)
+{
+    for(int rowin = 0; rowin < 4; rowin++)
     {
-        create_2Dimage_ID(ID_name_out, (xmax - xmin), (ymax - ymin), &ID_out);
-        naxes[0] = data.image[ID_out].md[0].size[0];
-        naxes[1] = data.image[ID_out].md[0].size[1];
+        long edge[6];
+        int  NBedge = 0;
+
+        edge[NBedge++] = plan->naxes[0];
+        for(int i = 0; i < 2; i++)
+        {
+            if(rowin & (1 << i))
+            {
+                edge[NBedge++] = plan->pos[i][0];
+                edge[NBedge++] = plan->pos[i][0] + plan->naxesin[i][0];
+            }
+        }
+
+        plan->NBseg[rowin] = 0;
+        for(long x = 0; x < plan->naxes[0];)
+        {
+            long xe    = plan->naxes[0];
+            int  cover = 0;
+            int  seg   = plan->NBseg[rowin];
 
-        for(jj = 0; jj < naxes[1]; jj++)
-            for(ii = 0; ii < naxes[0]; ii++)
+            for(int e = 0; e < NBedge; e++)
             {
+                if((edge[e] > x) && (edge[e] < xe))
                 {
-                    data.image[ID_out].array.F[jj * naxes[0] + ii] = 0;
-                    /* if pixel is in ID1 */
-                    if(((ii + xmin) >= 0) && ((ii + xmin) < naxes1[0]))
-                        if(((jj + ymin) >= 0) && ((jj + ymin) < naxes1[1]))
-                        {
-                            data.image[ID_out].array.F[jj * naxes[0] + ii] +=
-                                data.image[ID1]
-                                .array
-                                .F[(jj + ymin) * naxes1[0] + (ii + xmin)];
-                        }
-                    /* if pixel is in ID2 */
-                    if(((ii + xmin - off1) >= 0) &&
-                            ((ii + xmin - off1) < naxes2[0]))
-                        if(((jj + ymin - off2) >= 0) &&
-                                ((jj + ymin - off2) < naxes2[1]))
-                        {
-                            data.image[ID_out].array.F[jj * naxes[0] + ii] +=
-                                data.image[ID2]
-                                .array.F[(jj + ymin - off2) * naxes2[0] +
-                                                            (ii + xmin - off1)];
-                        }
+                    xe = edge[e];
                 }
             }
+            for(int i = 0; i < 2; i++)
+            {
+                if((rowin & (1 << i)) && (x >= plan->pos[i][0]) &&
+                        (x < plan->pos[i][0] + plan->naxesin[i][0]))
+                {
+                    cover |= 1 << i;
+                }
+            }
+            plan->segstart[rowin][seg] = x;
+            plan->segend[rowin][seg]   = xe;
+            plan->segcover[rowin][seg] = cover;
+            plan->NBseg[rowin]++;
+            x = xe;
+        }
     }
+}
 
-    if(datatype == _DATATYPE_DOUBLE)
+// write output row jj of plane kk
+static void image_add_planrow(const IMAGE_ADD_PLAN *plan, long kk, long jj)
+{
+    const char *inrow[2] = {NULL, NULL};
+    char       *outrow;
+    int         rowin = 0;
+
+    outrow = plan->out +
+             plan->typesize * (kk * plan->naxes[1] + jj) * plan->naxes[0];
+    for(int i = 0; i < 2; i++)
     {
-        create_2Dimage_ID_double(ID_name_out,
-                                 (xmax - xmin),
-                                 (ymax - ymin),
-                                 &ID_out);
-        naxes[0] = data.image[ID_out].md[0].size[0];
-        naxes[1] = data.image[ID_out].md[0].size[1];
+        long kkin = kk - plan->pos[i][2];
+        long jjin = jj - plan->pos[i][1];
 
-        for(jj = 0; jj < naxes[1]; jj++)
-            for(ii = 0; ii < naxes[0]; ii++)
+        if((kkin >= 0) && (kkin < plan->naxesin[i][2]) && (jjin >= 0) &&
+                (jjin < plan->naxesin[i][1]))
+        {
+            rowin |= 1 << i;
+            // first pixel of input row
+            inrow[i] = plan->in[i] +
+                       plan->typesizein[i] *
+                       ((kkin * plan->naxesin[i][1] + jjin) *
+                        plan->naxesin[i][0]);
+        }
+    }
+
+    for(int seg = 0; seg < plan->NBseg[rowin]; seg++)
+    {
+        long        x     = plan->segstart[rowin][seg];
+        long        n     = plan->segend[rowin][seg] - x;
+        int         cover = plan->segcover[rowin][seg];
+        char       *po    = outrow + plan->typesize * x;
+        const char *p[2]  = {NULL, NULL};
+
+        for(int i = 0; i < 2; i++)
+        {
+            if(cover & (1 << i))
             {
-                {
-                    data.image[ID_out].array.D[jj * naxes[0] + ii] = 0;
-                    /* if pixel is in ID1 */
-                    if(((ii + xmin) >= 0) && ((ii + xmin) < naxes1[0]))
-                        if(((jj + ymin) >= 0) && ((jj + ymin) < naxes1[1]))
-                        {
-                            data.image[ID_out].array.D[jj * naxes[0] + ii] +=
-                                data.image[ID1]
-                                .array
-                                .D[(jj + ymin) * naxes1[0] + (ii + xmin)];
-                        }
-                    /* if pixel is in ID2 */
-                    if(((ii + xmin - off1) >= 0) &&
-                            ((ii + xmin - off1) < naxes2[0]))
-                        if(((jj + ymin - off2) >= 0) &&
-                                ((jj + ymin - off2) < naxes2[1]))
-                        {
-                            data.image[ID_out].array.D[jj * naxes[0] + ii] +=
-                                data.image[ID2]
-                                .array.D[(jj + ymin - off2) * naxes2[0] +
-                                                            (ii + xmin - off1)];
-                        }
-                }
+                p[i] = inrow[i] + plan->typesizein[i] * (x - plan->pos[i][0]);
+            }
+        }
+
+        if(cover == 3)
+        {
+            if((plan->datatypein[0] == plan->datatype) &&
+                    (plan->datatypein[1] == plan->datatype))
+            {
+                int iscomplex;
+                int i = image_add_typeindex(plan->datatype, &iscomplex);
+
+                image_add_vec_table[i](po, p[0], p[1], iscomplex ? 2 * n : n);
+            }
+            else
+            {
+                image_add_convert(po,
+                                  plan->datatype,
+                                  p[0],
+                                  plan->datatypein[0],
+                                  n,
+                                  0);
+                image_add_convert(po,
+                                  plan->datatype,
+                                  p[1],
+                                  plan->datatypein[1],
+                                  n,
+                                  1);
+            }
+        }
+        else if(cover != 0)
+        {
+            int i = cover - 1;
+
+            if(plan->datatypein[i] == plan->datatype)
+            {
+                memcpy(po, p[i], plan->typesize * n);
+            }
+            else
+            {
+                image_add_convert(po,
+                                  plan->datatype,
+                                  p[i],
+                                  plan->datatypein[i],
+                                  n,
+                                  0);
+            }
+        }
+        else
+        {
+            memset(po, 0, plan->typesize * n);
+        }
+    }
+}
+
+static void *image_add_thread(void *ptr)
+{
+    IMAGE_ADD_THREAD *thread = (IMAGE_ADD_THREAD *) ptr;
+    long              ny     = thread->plan->naxes[1];
+
+    for(long row = thread->rowstart; row < thread->rowend; row++)
+    {
+        image_add_planrow(thread->plan, row / ny, row % ny);
+    }
+
+    return NULL;
+}
+
+// number of threads for NBrow rows of NBpix pixel operations in total
+static long image_add_nbthread(long NBrow, long NBpix)
+{
+    long NBthread = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(NBthread > NBpix / IMAGE_ADD_MINTHREADPIX)
+    {
+        NBthread = NBpix / IMAGE_ADD_MINTHREADPIX;
+    }
+    if(NBthread > NBrow)
+    {
+        NBthread = NBrow;
+    }
+    if(NBthread > IMAGE_ADD_MAXTHREAD)
+    {
+        NBthread = IMAGE_ADD_MAXTHREAD;
+    }
+    if(NBthread < 1)
+    {
+        NBthread = 1;
+    }
+
+    return NBthread;
+}
+
+/* execute add plan
+ *
+ * Output rows (all planes) are split in contiguous ranges, one per thread,
+ * so that threads get whole planes for cubes and row bands for thin cubes
+ * and 2D images. Small images are added by the calling thread.
+ */
+static void image_add_run(IMAGE_ADD_PLAN *plan)
+{
+    IMAGE_ADD_THREAD thread[IMAGE_ADD_MAXTHREAD];
+    pthread_t        threadID[IMAGE_ADD_MAXTHREAD];
+    long             NBrow = plan->naxes[1] * plan->naxes[2];
+    long             NBpix = NBrow * plan->naxes[0];
+    long             NBthread = image_add_nbthread(NBrow, NBpix);
+
+    image_add_plansegments(plan);
+
+    for(long t = 0; t < NBthread; t++)
+    {
+        thread[t].plan     = plan;
+        thread[t].rowstart = NBrow * t / NBthread;
+        thread[t].rowend   = NBrow * (t + 1) / NBthread;
+    }
+    for(long t = 1; t < NBthread; t++)
+    {
+        pthread_create(&threadID[t], NULL, image_add_thread, &thread[t]);
+    }
+    image_add_thread(&thread[0]);
+    for(long t = 1; t < NBthread; t++)
+    {
+        pthread_join(threadID[t], NULL);
+    }
+}
+
+// check input datatypes, returns output datatype
+static uint8_t image_add_datatype(imageID ID1, imageID ID2)
+{
+    uint8_t datatype;
+
+    datatype = image_add_promote(data.image[ID1].md[0].datatype,
+                                 data.image[ID2].md[0].datatype);
+    if(datatype == 0)
+    {
+        printf("ERROR in basic_add: data type combination not supported\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return datatype;
+}
+
+/* add images ID1 and ID2 (up to 3D), ID2 at offset off relative to ID1,
+ * into new image ID_name_out covering both
+ */
+static imageID image_add_union(imageID ID1,
+                               imageID ID2,
+                               const char *__restrict ID_name_out,
+                               int         naxis,
+                               const long *off)
+{
+    IMAGE_ADD_PLAN plan;
+    imageID        ID_out;
+    imageID        IDin[2] = {ID1, ID2};
+    uint32_t       naxesout[3];
+
+    memset(&plan, 0, sizeof(IMAGE_ADD_PLAN));
+    plan.datatype = image_add_datatype(ID1, ID2);
+    plan.typesize = ImageStreamIO_typesize(plan.datatype);
+
+    for(int i = 0; i < 2; i++)
+    {
+        plan.in[i]         = (const char *) data.image[IDin[i]].array.raw;
+        plan.datatypein[i] = data.image[IDin[i]].md[0].datatype;
+        plan.typesizein[i] = ImageStreamIO_typesize(plan.datatypein[i]);
+        // axes beyond the output naxis are dropped, only plane 0 is used
+        for(int ax = 0; ax < 3; ax++)
+        {
+            plan.naxesin[i][ax] = 1;
+            if((ax < naxis) && (ax < data.image[IDin[i]].md[0].naxis))
+            {
+                plan.naxesin[i][ax] = data.image[IDin[i]].md[0].size[ax];
             }
+        }
+    }
+
+    // extrema in the ID1 coordinates
+    for(int ax = 0; ax < 3; ax++)
+    {
+        long axoff = (ax < naxis) ? off[ax] : 0;
+        long axmin = (axoff < 0) ? axoff : 0;
+        long axmax = plan.naxesin[0][ax];
+
+        if(plan.naxesin[1][ax] + axoff > axmax)
+        {
+            axmax = plan.naxesin[1][ax] + axoff;
+        }
+        plan.naxes[ax]  = axmax - axmin;
+        plan.pos[0][ax] = -axmin;
+        plan.pos[1][ax] = axoff - axmin;
+        naxesout[ax]    = plan.naxes[ax];
     }
 
-    return (ID_out);
+    create_image_ID(ID_name_out,
+                    naxis,
+                    naxesout,
+                    plan.datatype,
+                    0,
+                    0,
+                    0,
+                    &ID_out);
+    plan.out = (char *) data.image[ID_out].array.raw;
+
+    image_add_run(&plan);
+
+    return ID_out;
+}
+
+// add two 2D images, image 2 at offset (off1, off2) relative to image 1
+//
+// The output covers the union of both images, its datatype is promoted
+// from the input datatypes (see image_add_promote), conversion is fused
+// with the add.
+imageID basic_add(const char *__restrict ID_name1,
+                  const char *__restrict ID_name2,
+                  const char *__restrict ID_name_out,
+                  long off1,
+                  long off2)
+{
+    long off[2] = {off1, off2};
+
+    return image_add_union(image_ID(ID_name1),
+                           image_ID(ID_name2),
+                           ID_name_out,
+                           2,
+                           off);
 }
 
+// add two 3D images, image 2 at offset (off1, off2, off3) relative to
+// image 1. Output datatype as basic_add.
+// Output rows are distributed over threads for large images.
 imageID basic_add3D(const char *__restrict ID_name1,
                     const char *__restrict ID_name2,
                     const char *__restrict ID_name_out,
@@ -244,194 +894,626 @@ imageID basic_add3D(const char *__restrict ID_name1,
                     long off2,
                     long off3)
 {
-    imageID  ID1, ID2; /* ID for the 2 images added */
-    imageID  ID_out;   /* ID for the output image */
-    uint32_t naxes1[3], naxes2[3], naxes[3];
-    long     xmin, ymin, zmin, xmax, ymax,
-             zmax; /* extrema in the ID1 coordinates */
-    uint8_t datatype1, datatype2, datatype;
-    int     datatypeOK;
+    long off[3] = {off1, off2, off3};
+
+    return image_add_union(image_ID(ID_name1),
+                           image_ID(ID_name2),
+                           ID_name_out,
+                           3,
+                           off);
+}
+
+/* im1 += im2, image 2 at offset (off1, off2) relative to image 1
+ *
+ * Pixels of image 2 outside image 1 are ignored, nothing is allocated.
+ * Image 2 is converted to the datatype of image 1 within the add (a
+ * complex image cannot be added into a real one).
+ *
+ * returns ID1, -1 on error
+ */
+imageID basic_add_inplace_byID(imageID ID1, imageID ID2, long off1, long off2)
+{
+    long    naxes1[2], naxes2[2];
+    long    x2min, x2max, y2min, y2max; /* overlap in the ID2 coordinates */
+    uint8_t datatype1, datatype2;
+    size_t  typesize1, typesize2;
+    int     c1, c2;
 
-    ID1       = image_ID(ID_name1);
-    ID2       = image_ID(ID_name2);
     naxes1[0] = data.image[ID1].md[0].size[0];
     naxes1[1] = data.image[ID1].md[0].size[1];
-    naxes1[2] = data.image[ID1].md[0].size[2];
-
     naxes2[0] = data.image[ID2].md[0].size[0];
     naxes2[1] = data.image[ID2].md[0].size[1];
-    naxes2[2] = data.image[ID2].md[0].size[2];
+    if(data.image[ID1].md[0].naxis == 1)
+    {
+        naxes1[1] = 1;
+    }
+    if(data.image[ID2].md[0].naxis == 1)
+    {
+        naxes2[1] = 1;
+    }
 
     datatype1 = data.image[ID1].md[0].datatype;
     datatype2 = data.image[ID2].md[0].datatype;
+    if((image_add_typeindex(datatype1, &c1) == -1) ||
+            (image_add_typeindex(datatype2, &c2) == -1) || (c2 > c1))
+    {
+        PRINT_ERROR("data type combination not supported");
+        return -1;
+    }
+    typesize1 = ImageStreamIO_typesize(datatype1);
+    typesize2 = ImageStreamIO_typesize(datatype2);
 
-    datatypeOK = 0;
+    x2min = (off1 < 0) ? -off1 : 0;
+    y2min = (off2 < 0) ? -off2 : 0;
+    x2max = naxes2[0];
+    if(naxes1[0] - off1 < x2max)
+    {
+        x2max = naxes1[0] - off1;
+    }
+    y2max = naxes2[1];
+    if(naxes1[1] - off2 < y2max)
+    {
+        y2max = naxes1[1] - off2;
+    }
 
-    if((datatype1 == _DATATYPE_FLOAT) && (datatype2 == _DATATYPE_FLOAT))
+    for(long jj2 = y2min; jj2 < y2max; jj2++)
     {
-        datatype   = _DATATYPE_FLOAT;
-        datatypeOK = 1;
+        if(x2max <= x2min)
+        {
+            break;
+        }
+        image_add_convert((char *) data.image[ID1].array.raw +
+                          typesize1 *
+                          ((jj2 + off2) * naxes1[0] + x2min + off1),
+                          datatype1,
+                          (const char *) data.image[ID2].array.raw +
+                          typesize2 * (jj2 * naxes2[0] + x2min),
+                          datatype2,
+                          x2max - x2min,
+                          1);
     }
-    if((datatype1 == _DATATYPE_DOUBLE) && (datatype2 == _DATATYPE_DOUBLE))
+
+    return ID1;
+}
+
+imageID basic_add_inplace(const char *__restrict ID_name1,
+                          const char *__restrict ID_name2,
+                          long off1,
+                          long off2)
+{
+    imageID ID1 = image_ID(ID_name1);
+    imageID ID2 = image_ID(ID_name2);
+
+    if((ID1 == -1) || (ID2 == -1))
     {
-        datatype   = _DATATYPE_DOUBLE;
-        datatypeOK = 1;
+        PRINT_ERROR("image %s not found", (ID1 == -1) ? ID_name1 : ID_name2);
+        return -1;
     }
 
-    if(datatypeOK == 0)
+    return basic_add_inplace_byID(ID1, ID2, off1, off2);
+}
+
+typedef struct
+{
+    const char *ptr;
+    uint8_t     datatype;
+    size_t      typesize;
+    long        naxes[2];
+    long        pos[2]; // origin in output coordinates
+    double      weight;
+} IMAGE_ADD_TILE;
+
+typedef struct
+{
+    const IMAGE_ADD_TILE *tile;
+    int                   NBtile;
+    char                 *out;
+    float                *wmap;
+    uint8_t               datatype; // float or double
+    long                  naxes[2];
+    int                   normalize;
+    long                  rowstart;
+    long                  rowend;
+} IMAGE_ADD_MOSAIC;
+
+// accumulate all tiles into output rows [rowstart, rowend), then normalize
+static void *image_add_mosaic_thread(void *ptr)
+{
+    IMAGE_ADD_MOSAIC *mos      = (IMAGE_ADD_MOSAIC *) ptr;
+    size_t            typesize = ImageStreamIO_typesize(mos->datatype);
+    int               iout     = (mos->datatype == _DATATYPE_DOUBLE) ? 1 : 0;
+
+    for(long jj = mos->rowstart; jj < mos->rowend; jj++)
     {
-        printf("ERROR in basic_add: data type combination not supported\n");
-        exit(0);
+        char  *outrow  = mos->out + typesize * jj * mos->naxes[0];
+        float *wmaprow = mos->wmap + jj * mos->naxes[0];
+
+        memset(outrow, 0, typesize * mos->naxes[0]);
+        memset(wmaprow, 0, sizeof(float) * mos->naxes[0]);
+
+        for(int t = 0; t < mos->NBtile; t++)
+        {
+            const IMAGE_ADD_TILE *tile = &mos->tile[t];
+            long                  jjt  = jj - tile->pos[1];
+            int                   iscomplex;
+
+            if((jjt < 0) || (jjt >= tile->naxes[1]))
+            {
+                continue;
+            }
+            image_add_wacc_table[iout]
+            [image_add_typeindex(tile->datatype, &iscomplex)](
+                outrow + typesize * tile->pos[0],
+                tile->ptr + tile->typesize * jjt * tile->naxes[0],
+                tile->naxes[0],
+                tile->weight);
+            for(long ii = 0; ii < tile->naxes[0]; ii++)
+            {
+                wmaprow[tile->pos[0] + ii] += tile->weight;
+            }
+        }
+
+        if(mos->normalize == 1)
+        {
+            for(long ii = 0; ii < mos->naxes[0]; ii++)
+            {
+                if(wmaprow[ii] > 0.0)
+                {
+                    if(iout == 1)
+                    {
+                        ((double *) outrow)[ii] /= wmaprow[ii];
+                    }
+                    else
+                    {
+                        ((float *) outrow)[ii] /= wmaprow[ii];
+                    }
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* weighted mosaic of N 2D images
+ *
+ * tilelist : comma-separated im:offx:offy[:weight], weight defaults to 1
+ *
+ * The output covers the union of all tiles, its pixel (0,0) is at the
+ * smallest tile offsets. All tiles are accumulated in one pass,
+ * sum(weight x tile), together with the weight map <ID_name_out>_wmap,
+ * sum(weight). With normalize = 1 the output is divided by the weight map
+ * where it is positive.
+ *
+ * Output is float, double if a tile is double or a 32/64 bit integer.
+ * Output row bands are distributed over threads.
+ */
+imageID basic_mosaic(const char *__restrict tilelist,
+                     const char *__restrict ID_name_out,
+                     int normalize)
+{
+    IMAGE_ADD_TILE   *tile;
+    IMAGE_ADD_MOSAIC  thread[IMAGE_ADD_MAXTHREAD];
+    pthread_t         threadID[IMAGE_ADD_MAXTHREAD];
+    int               NBtile;
+    char             *list;
+    char             *saveptr;
+    char             *tok;
+    long              posmin[2], posmax[2];
+    uint32_t          naxesout[2];
+    uint8_t           datatype = _DATATYPE_FLOAT;
+    imageID           ID_out;
+    imageID           ID_wmap;
+    char              wmapname[STRINGMAXLEN_IMGNAME];
+    long              NBthread;
+
+    // one tile per comma
+    NBtile = 1;
+    for(const char *c = tilelist; *c != '\0'; c++)
+    {
+        if(*c == ',')
+        {
+            NBtile++;
+        }
+    }
+    tile = (IMAGE_ADD_TILE *) malloc(sizeof(IMAGE_ADD_TILE) * NBtile);
+    list = strdup(tilelist);
+    if((tile == NULL) || (list == NULL))
+    {
+        PRINT_ERROR("malloc returns NULL pointer");
+        abort();
+    }
+
+    NBtile = 0;
+    tok    = strtok_r(list, ",", &saveptr);
+    while(tok != NULL)
+    {
+        IMAGE_ADD_TILE *t = &tile[NBtile];
+        char           *field[3] = {NULL, NULL, NULL};
+        char           *sep      = tok;
+        imageID         ID;
+        int             iscomplex;
+
+        for(int f = 0; f < 3; f++)
+        {
+            sep = strchr(sep, ':');
+            if(sep == NULL)
+            {
+                break;
+            }
+            *sep     = '\0';
+            sep      = sep + 1;
+            field[f] = sep;
+        }
+        ID = image_ID(tok);
+        if((ID == -1) || (field[1] == NULL))
+        {
+            PRINT_ERROR("invalid tile %s (image:offx:offy[:weight])", tok);
+            free(list);
+            free(tile);
+            return -1;
+        }
+        if((image_add_typeindex(data.image[ID].md[0].datatype, &iscomplex) ==
+                -1) ||
+                (iscomplex == 1))
+        {
+            PRINT_ERROR("image %s : datatype not supported", tok);
+            free(list);
+            free(tile);
+            return -1;
+        }
+
+        t->ptr      = (const char *) data.image[ID].array.raw;
+        t->datatype = data.image[ID].md[0].datatype;
+        t->typesize = ImageStreamIO_typesize(t->datatype);
+        t->naxes[0] = data.image[ID].md[0].size[0];
+        t->naxes[1] = 1;
+        if(data.image[ID].md[0].naxis > 1)
+        {
+            t->naxes[1] = data.image[ID].md[0].size[1];
+        }
+        t->pos[0] = atol(field[0]);
+        t->pos[1] = atol(field[1]);
+        t->weight = (field[2] != NULL) ? atof(field[2]) : 1.0;
+        datatype  = image_add_promote(datatype, t->datatype);
+
+        for(int ax = 0; ax < 2; ax++)
+        {
+            if((NBtile == 0) || (t->pos[ax] < posmin[ax]))
+            {
+                posmin[ax] = t->pos[ax];
+            }
+            if((NBtile == 0) || (t->pos[ax] + t->naxes[ax] > posmax[ax]))
+            {
+                posmax[ax] = t->pos[ax] + t->naxes[ax];
+            }
+        }
+        NBtile++;
+        tok = strtok_r(NULL, ",", &saveptr);
     }
+    free(list);
 
-    /*  if(data.quiet==0)*/
-    /* printf("add called with %s ( %ld x %ld ) %s ( %ld x %ld ) and offset ( %ld x %ld )\n",ID_name1,naxes1[0],naxes1[1],ID_name2,naxes2[0],naxes2[1],off1,off2);*/
-    xmin = 0;
-    if(off1 < 0)
+    if(NBtile == 0)
     {
-        xmin = off1;
+        PRINT_ERROR("empty tile list");
+        free(tile);
+        return -1;
     }
 
-    ymin = 0;
-    if(off2 < 0)
+    for(int t = 0; t < NBtile; t++)
     {
-        ymin = off2;
+        tile[t].pos[0] -= posmin[0];
+        tile[t].pos[1] -= posmin[1];
     }
+    naxesout[0] = posmax[0] - posmin[0];
+    naxesout[1] = posmax[1] - posmin[1];
+    create_image_ID(ID_name_out, 2, naxesout, datatype, 0, 0, 0, &ID_out);
+    WRITE_IMAGENAME(wmapname, "%s_wmap", ID_name_out);
+    create_2Dimage_ID(wmapname, naxesout[0], naxesout[1], &ID_wmap);
+
+    printf("%d tiles -> %u x %u, origin at %ld %ld\n",
+           NBtile,
+           naxesout[0],
+           naxesout[1],
+           posmin[0],
+           posmin[1]);
+
+    NBthread = image_add_nbthread(naxesout[1],
+                                  (long) naxesout[0] * naxesout[1] * NBtile);
 
-    zmin = 0;
-    if(off3 < 0)
+    for(long th = 0; th < NBthread; th++)
     {
-        zmin = off3;
+        thread[th].tile      = tile;
+        thread[th].NBtile    = NBtile;
+        thread[th].out       = (char *) data.image[ID_out].array.raw;
+        thread[th].wmap      = data.image[ID_wmap].array.F;
+        thread[th].datatype  = datatype;
+        thread[th].naxes[0]  = naxesout[0];
+        thread[th].naxes[1]  = naxesout[1];
+        thread[th].normalize = normalize;
+        thread[th].rowstart  = naxesout[1] * th / NBthread;
+        thread[th].rowend    = naxesout[1] * (th + 1) / NBthread;
     }
+    for(long th = 1; th < NBthread; th++)
+    {
+        pthread_create(&threadID[th],
+                       NULL,
+                       image_add_mosaic_thread,
+                       &thread[th]);
+    }
+    image_add_mosaic_thread(&thread[0]);
+    for(long th = 1; th < NBthread; th++)
+    {
+        pthread_join(threadID[th], NULL);
+    }
+
+    free(tile);
+
+    return ID_out;
+}
+
+#define IMAGE_ADD_MAXTAP 6
+
+typedef struct
+{
+    char       *out;
+    uint8_t     datatype; // float or double
+    long        naxes[2];
+    const char *in;
+    uint8_t     datatypein;
+    size_t      typesizein;
+    long        naxesin[2];
+    long        base[2]; // input tap 0 of output pixel 0 along x, y
+    int         NBtap;
+    double      w[2][IMAGE_ADD_MAXTAP]; // x, y tap weights
+    long        rowstart;
+    long        rowend;
+} IMAGE_ADD_SHIFT;
+
+// interpolation kernel value at x, its half width returned in *radius
+static double image_add_interp(int kernel, double x, int *radius)
+{
+    double ax = fabs(x);
 
-    xmax = naxes1[0];
-    if((naxes2[0] + off1) > naxes1[0])
+    switch(kernel)
     {
-        xmax = (naxes2[0] + off1);
+    case 1: // cubic convolution, a = -0.5
+        *radius = 2;
+        if(ax < 1.0)
+        {
+            return (1.5 * ax - 2.5) * ax * ax + 1.0;
+        }
+        if(ax < 2.0)
+        {
+            return ((-0.5 * ax + 2.5) * ax - 4.0) * ax + 2.0;
+        }
+        return 0.0;
+
+    case 2: // Lanczos-3
+        *radius = 3;
+        if(ax < 1e-12)
+        {
+            return 1.0;
+        }
+        if(ax < 3.0)
+        {
+            return 3.0 * sin(M_PI * ax) * sin(M_PI * ax / 3.0) /
+                   (M_PI * M_PI * ax * ax);
+        }
+        return 0.0;
+
+    default: // bilinear
+        *radius = 1;
+        return (ax < 1.0) ? 1.0 - ax : 0.0;
     }
+}
 
-    ymax = naxes1[1];
-    if((naxes2[1] + off2) > naxes1[1])
+/* Each output row is the weighted sum of NBtap input rows, accumulated into
+ * a zero-padded double row, then NBtap horizontal taps are added into the
+ * output row. Taps outside the input contribute zero.
+ */
+static void *image_add_shift_thread(void *ptr)
+{
+    IMAGE_ADD_SHIFT *sh     = (IMAGE_ADD_SHIFT *) ptr;
+    long             pad    = sh->NBtap;
+    double          *tmp    = NULL;
+    long             iimin  = -sh->base[0] - sh->NBtap + 1;
+    long             iimax  = sh->naxesin[0] - sh->base[0];
+    int              itype  = 0;
+    int              iscomplex;
+
+    tmp = (double *) malloc(sizeof(double) * (sh->naxesin[0] + 2 * pad));
+    if(tmp == NULL)
     {
-        ymax = (naxes2[1] + off2);
+        PRINT_ERROR("malloc returns NULL pointer");
+        abort();
     }
+    itype = image_add_typeindex(sh->datatypein, &iscomplex);
 
-    zmax = naxes1[2];
-    if((naxes2[2] + off3) > naxes1[2])
+    // output pixels with at least one horizontal tap inside the input
+    if(iimin < 0)
+    {
+        iimin = 0;
+    }
+    if(iimax > sh->naxes[0])
     {
-        zmax = (naxes2[2] + off3);
+        iimax = sh->naxes[0];
     }
 
-    if(datatype == _DATATYPE_FLOAT)
+    for(long jj = sh->rowstart; jj < sh->rowend; jj++)
     {
-        create_3Dimage_ID(ID_name_out,
-                          (xmax - xmin),
-                          (ymax - ymin),
-                          (zmax - zmin),
-                          &ID_out);
-        naxes[0] = data.image[ID_out].md[0].size[0];
-        naxes[1] = data.image[ID_out].md[0].size[1];
-        naxes[2] = data.image[ID_out].md[0].size[2];
+        int    NBrow = 0;
+        double *row  = tmp + pad + sh->base[0];
 
-        for(uint32_t kk = 0; kk < naxes[2]; kk++)
-            for(uint32_t jj = 0; jj < naxes[1]; jj++)
-                for(uint32_t ii = 0; ii < naxes[0]; ii++)
+        memset(tmp, 0, sizeof(double) * (sh->naxesin[0] + 2 * pad));
+        for(int t = 0; t < sh->NBtap; t++)
+        {
+            long jjin = jj + sh->base[1] + t;
+
+            if((jjin < 0) || (jjin >= sh->naxesin[1]) ||
+                    (sh->w[1][t] == 0.0))
+            {
+                continue;
+            }
+            image_add_wacc_table[1][itype](
+                tmp + pad,
+                sh->in + sh->typesizein * jjin * sh->naxesin[0],
+                sh->naxesin[0],
+                sh->w[1][t]);
+            NBrow++;
+        }
+        if((NBrow == 0) || (iimax <= iimin))
+        {
+            continue;
+        }
+
+        if(sh->datatype == _DATATYPE_DOUBLE)
+        {
+            double *out = (double *) sh->out + jj * sh->naxes[0];
+            for(long ii = iimin; ii < iimax; ii++)
+            {
+                double v = 0.0;
+                for(int t = 0; t < sh->NBtap; t++)
                 {
-                    {
-                        data.image[ID_out].array.F[kk * naxes[1] * naxes[0] +
-                                                   jj * naxes[0] + ii] = 0;
-                        /* if pixel is in ID1 */
-
-                        if(((ii + xmin) >= 0) && ((ii + xmin) < naxes1[0]))
-                            if(((jj + ymin) >= 0) && ((jj + ymin) < naxes1[1]))
-                                if(((kk + zmin) >= 0) &&
-                                        ((kk + zmin) < naxes1[2]))
-                                {
-                                    data.image[ID_out]
-                                    .array.F[kk * naxes[1] * naxes[0] +
-                                                jj * naxes[0] + ii] +=
-                                                 data.image[ID1]
-                                                 .array.F[(kk + zmin) * naxes1[1] *
-                                                                      naxes1[0] +
-                                                                      (jj + ymin) * naxes1[0] +
-                                                                      (ii + xmin)];
-                                }
-                        /* if pixel is in ID2 */
-                        if(((ii + xmin - off1) >= 0) &&
-                                ((ii + xmin - off1) < naxes2[0]))
-                            if(((jj + ymin - off2) >= 0) &&
-                                    ((jj + ymin - off2) < naxes2[1]))
-                                if(((kk + zmin - off3) >= 0) &&
-                                        ((kk + zmin - off3) < naxes2[2]))
-                                {
-                                    data.image[ID_out]
-                                    .array.F[kk * naxes[1] * naxes[0] +
-                                                jj * naxes[0] + ii] +=
-                                                 data.image[ID2]
-                                                 .array
-                                                 .F[(kk + zmin - off3) * naxes2[1] *
-                                                                       naxes2[0] +
-                                                                       (jj + ymin - off2) * naxes2[0] +
-                                                                       (ii + xmin - off1)];
-                                }
-                    }
+                    v += sh->w[0][t] * row[ii + t];
                 }
+                out[ii] += v;
+            }
+        }
+        else
+        {
+            float *out = (float *) sh->out + jj * sh->naxes[0];
+            for(long ii = iimin; ii < iimax; ii++)
+            {
+                double v = 0.0;
+                for(int t = 0; t < sh->NBtap; t++)
+                {
+                    v += sh->w[0][t] * row[ii + t];
+                }
+                out[ii] += (float) v;
+            }
+        }
     }
 
-    if(datatype == _DATATYPE_DOUBLE)
+    free(tmp);
+
+    return NULL;
+}
+
+/* add image ID2 into ID1 at sub-pixel offset (off1, off2)
+ *
+ * ID1(x + off1, y + off2) += ID2(x, y), with ID2 interpolated by a separable
+ * kernel: 0 bilinear, 1 cubic convolution, 2 Lanczos-3 (weights normalized).
+ * As the offset is the same for all pixels, tap weights are computed once
+ * per call. Output is clipped to ID1, which must be float or double. ID2 can
+ * be any real type. Integer offsets reproduce basic_add_inplace_byID.
+ */
+imageID basic_add_shift_byID(imageID ID1,
+                             imageID ID2,
+                             double  off1,
+                             double  off2,
+                             int     kernel)
+{
+    IMAGE_ADD_SHIFT sh[IMAGE_ADD_MAXTHREAD];
+    pthread_t       threadID[IMAGE_ADD_MAXTHREAD];
+    double          off[2] = {off1, off2};
+    long            NBthread;
+    int             radius;
+    int             iscomplex;
+
+    sh[0].out        = (char *) data.image[ID1].array.raw;
+    sh[0].datatype   = data.image[ID1].md[0].datatype;
+    sh[0].in         = (const char *) data.image[ID2].array.raw;
+    sh[0].datatypein = data.image[ID2].md[0].datatype;
+    sh[0].typesizein = ImageStreamIO_typesize(sh[0].datatypein);
+    if(((sh[0].datatype != _DATATYPE_FLOAT) &&
+            (sh[0].datatype != _DATATYPE_DOUBLE)) ||
+            (image_add_typeindex(sh[0].datatypein, &iscomplex) == -1) ||
+            (iscomplex == 1))
     {
-        create_3Dimage_ID_double(ID_name_out,
-                                 (xmax - xmin),
-                                 (ymax - ymin),
-                                 (zmax - zmin),
-                                 &ID_out);
-        naxes[0] = data.image[ID_out].md[0].size[0];
-        naxes[1] = data.image[ID_out].md[0].size[1];
-        naxes[2] = data.image[ID_out].md[0].size[2];
+        PRINT_ERROR("data type combination not supported");
+        return -1;
+    }
+    sh[0].naxes[0]   = data.image[ID1].md[0].size[0];
+    sh[0].naxes[1]   = 1;
+    sh[0].naxesin[0] = data.image[ID2].md[0].size[0];
+    sh[0].naxesin[1] = 1;
+    if(data.image[ID1].md[0].naxis > 1)
+    {
+        sh[0].naxes[1] = data.image[ID1].md[0].size[1];
+    }
+    if(data.image[ID2].md[0].naxis > 1)
+    {
+        sh[0].naxesin[1] = data.image[ID2].md[0].size[1];
+    }
 
-        for(uint32_t kk = 0; kk < naxes[2]; kk++)
-            for(uint32_t jj = 0; jj < naxes[1]; jj++)
-                for(uint32_t ii = 0; ii < naxes[0]; ii++)
-                {
-                    {
-                        data.image[ID_out].array.D[kk * naxes[1] * naxes[0] +
-                                                   jj * naxes[0] + ii] = 0;
-                        /* if pixel is in ID1 */
-                        if(((ii + xmin) >= 0) && ((ii + xmin) < naxes1[0]))
-                            if(((jj + ymin) >= 0) && ((jj + ymin) < naxes1[1]))
-                                if(((kk + zmin) >= 0) &&
-                                        ((kk + zmin) < naxes1[2]))
-                                {
-                                    data.image[ID_out]
-                                    .array.D[kk * naxes[1] * naxes[0] +
-                                                jj * naxes[0] + ii] +=
-                                                 data.image[ID1]
-                                                 .array.D[(kk + zmin) * naxes1[1] *
-                                                                      naxes1[0] +
-                                                                      (jj + ymin) * naxes1[0] +
-                                                                      (ii + xmin)];
-                                }
-                        /* if pixel is in ID2 */
-                        if(((ii + xmin - off1) >= 0) &&
-                                ((ii + xmin - off1) < naxes2[0]))
-                            if(((jj + ymin - off2) >= 0) &&
-                                    ((jj + ymin - off2) < naxes2[1]))
-                                if(((kk + zmin - off3) >= 0) &&
-                                        ((kk + zmin - off3) < naxes2[2]))
-                                {
-                                    data.image[ID_out]
-                                    .array.D[kk * naxes[1] * naxes[0] +
-                                                jj * naxes[0] + ii] +=
-                                                 data.image[ID2]
-                                                 .array
-                                                 .D[(kk + zmin - off3) * naxes2[1] *
-                                                                       naxes2[0] +
-                                                                       (jj + ymin - off2) * naxes2[0] +
-                                                                       (ii + xmin - off1)];
-                                }
-                    }
-                }
+    image_add_interp(kernel, 0.0, &radius);
+    sh[0].NBtap = 2 * radius;
+    for(int ax = 0; ax < 2; ax++)
+    {
+        // output pixel p samples input at p - off, taps at floor(p - off)
+        // + 1 - radius ... floor(p - off) + radius
+        double fl   = floor(-off[ax]);
+        double frac = -off[ax] - fl;
+        double wsum = 0.0;
+
+        sh[0].base[ax] = (long) fl + 1 - radius;
+        for(int t = 0; t < sh[0].NBtap; t++)
+        {
+            sh[0].w[ax][t] =
+                image_add_interp(kernel, frac - (t + 1 - radius), &radius);
+            if(frac == 0.0)
+            {
+                // integer offset: single tap, exact
+                sh[0].w[ax][t] = (t == radius - 1) ? 1.0 : 0.0;
+            }
+            wsum += sh[0].w[ax][t];
+        }
+        for(int t = 0; t < sh[0].NBtap; t++)
+        {
+            sh[0].w[ax][t] /= wsum;
+        }
+    }
+
+    NBthread = image_add_nbthread(sh[0].naxes[1],
+                                  sh[0].naxes[1] * sh[0].naxesin[0] *
+                                  sh[0].NBtap);
+    for(long th = 0; th < NBthread; th++)
+    {
+        if(th > 0)
+        {
+            sh[th] = sh[0];
+        }
+        sh[th].rowstart = sh[0].naxes[1] * th / NBthread;
+        sh[th].rowend   = sh[0].naxes[1] * (th + 1) / NBthread;
+    }
+    for(long th = 1; th < NBthread; th++)
+    {
+        pthread_create(&threadID[th], NULL, image_add_shift_thread, &sh[th]);
+    }
+    image_add_shift_thread(&sh[0]);
+    for(long th = 1; th < NBthread; th++)
+    {
+        pthread_join(threadID[th], NULL);
+    }
+
+    return ID1;
+}
+
+imageID basic_add_shift(const char *__restrict ID_name1,
+                        const char *__restrict ID_name2,
+                        double off1,
+                        double off2,
+                        int kernel)
+{
+    imageID ID1 = image_ID(ID_name1);
+    imageID ID2 = image_ID(ID_name2);
+
+    if((ID1 == -1) || (ID2 == -1))
+    {
+        PRINT_ERROR("image %s not found", (ID1 == -1) ? ID_name1 : ID_name2);
+        return -1;
     }
 
-    return (ID_out);
+    return basic_add_shift_byID(ID1, ID2, off1, off2, kernel);
 }
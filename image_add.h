@@ -15,3 +15,26 @@ imageID basic_add3D(const char *__restrict ID_name1,
                     long off1,
                     long off2,
                     long off3);
+
+imageID basic_add_inplace_byID(imageID ID1, imageID ID2, long off1, long off2);
+
+imageID basic_add_inplace(const char *__restrict ID_name1,
+                          const char *__restrict ID_name2,
+                          long off1,
+                          long off2);
+
+imageID basic_mosaic(const char *__restrict tilelist,
+                     const char *__restrict ID_name_out,
+                     int normalize);
+
+imageID basic_add_shift_byID(imageID ID1,
+                             imageID ID2,
+                             double  off1,
+                             double  off2,
+                             int     kernel);
+
+imageID basic_add_shift(const char *__restrict ID_name1,
+                        const char *__restrict ID_name2,
+                        double off1,
+                        double off2,
+                        int kernel);
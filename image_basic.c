@@ -61,7 +61,10 @@
 #include "imswapaxis2D.h"
 #include "indexmap.h"
 #include "loadfitsimgcube.h"
+#include "streambench.h"
 #include "streamfeed.h"
+#include "streamop.h"
+#include "streamrecdisk.h"
 #include "streamrecord.h"
 
 /*
@@ -109,6 +112,9 @@ static errno_t init_module_CLI()
     loadfitsimgcube_addCLIcmd();
     streamfeed_addCLIcmd();
     streamrecord_addCLIcmd();
+    streamrecdisk_addCLIcmd();
+    streamop_addCLIcmd();
+    streambench_addCLIcmd();
     cubecollapse_addCLIcmd();
 
     // add atexit functions here
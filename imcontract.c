@@ -1,34 +1,80 @@
 /** @file imcontract.c
  */
 
+#include <math.h>
+#include <pthread.h>
+
 #include "CommandLineInterface/CLIcore.h"
 
 #include "COREMOD_memory/COREMOD_memory.h"
 
+#include "imcontract.h"
+
 // ==========================================
 // Forward declaration(s)
 // ==========================================
 
-imageID
-basic_contract(const char *ID_name, const char *ID_name_out, int n1, int n2);
+imageID basic_contract(
+    const char *ID_name, const char *ID_name_out, int n1, int n2, int mode);
+
+imageID basic_contract3D(const char *ID_name,
+                         const char *ID_name_out,
+                         int         n1,
+                         int         n2,
+                         int         n3,
+                         int         mode);
 
-imageID basic_contract3D(
-    const char *ID_name, const char *ID_name_out, int n1, int n2, int n3);
+errno_t basic_contract_frame_add(double     *out,
+                                 const void *in,
+                                 uint8_t     datatype,
+                                 uint32_t    xsize,
+                                 uint32_t    ysize,
+                                 int         n1,
+                                 int         n2);
+
+imageID basic_rebin(const char *ID_name,
+                    const char *ID_name_out,
+                    long        xsizeout,
+                    long        ysizeout);
 
 // ==========================================
 // Command line interface wrapper function(s)
 // ==========================================
 
+// binning mode from name, -1 if unknown
+static int imcontract_mode(const char *modename)
+{
+    const char *name[] = {"sum", "mean", "min", "max", "median"};
+
+    for(int mode = 0; mode < 5; mode++)
+    {
+        if(strcmp(modename, name[mode]) == 0)
+        {
+            return mode;
+        }
+    }
+    PRINT_ERROR("unknown mode %s (sum, mean, min, max, median)", modename);
+
+    return -1;
+}
+
 static errno_t image_basic_contract_cli()
 {
     if(CLI_checkarg(1, 4) + CLI_checkarg(2, 3) + CLI_checkarg(3, 2) +
-            CLI_checkarg(4, 2) ==
+            CLI_checkarg(4, 2) + CLI_checkarg(5, 5) ==
             0)
     {
+        int mode = imcontract_mode(data.cmdargtoken[5].val.string);
+
+        if(mode == -1)
+        {
+            return CLICMD_INVALID_ARG;
+        }
         basic_contract(data.cmdargtoken[1].val.string,
                        data.cmdargtoken[2].val.string,
                        data.cmdargtoken[3].val.numl,
-                       data.cmdargtoken[4].val.numl);
+                       data.cmdargtoken[4].val.numl,
+                       mode);
         return CLICMD_SUCCESS;
     }
     else
@@ -40,14 +86,39 @@ static errno_t image_basic_contract_cli()
 static errno_t image_basic_contract3D_cli()
 {
     if(CLI_checkarg(1, 4) + CLI_checkarg(2, 3) + CLI_checkarg(3, 2) +
-            CLI_checkarg(4, 2) + CLI_checkarg(5, 2) ==
+            CLI_checkarg(4, 2) + CLI_checkarg(5, 2) + CLI_checkarg(6, 5) ==
             0)
     {
+        int mode = imcontract_mode(data.cmdargtoken[6].val.string);
+
+        if(mode == -1)
+        {
+            return CLICMD_INVALID_ARG;
+        }
         basic_contract3D(data.cmdargtoken[1].val.string,
                          data.cmdargtoken[2].val.string,
                          data.cmdargtoken[3].val.numl,
                          data.cmdargtoken[4].val.numl,
-                         data.cmdargtoken[5].val.numl);
+                         data.cmdargtoken[5].val.numl,
+                         mode);
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+static errno_t image_basic_rebin_cli()
+{
+    if(CLI_checkarg(1, 4) + CLI_checkarg(2, 3) + CLI_checkarg(3, 2) +
+            CLI_checkarg(4, 2) ==
+            0)
+    {
+        basic_rebin(data.cmdargtoken[1].val.string,
+                    data.cmdargtoken[2].val.string,
+                    data.cmdargtoken[3].val.numl,
+                    data.cmdargtoken[4].val.numl);
         return CLICMD_SUCCESS;
     }
     else
@@ -67,206 +138,1383 @@ errno_t imcontract_addCLIcmd()
                        __FILE__,
                        image_basic_contract_cli,
                        "image binning",
-                       "<inim> <outim> <binx> <biny>",
-                       "imcontract im1 outim 4 4",
+                       "<inim> <outim> <binx> <biny> "
+                       "<mode (sum/mean/min/max/median)>",
+                       "imcontract im1 outim 4 4 sum",
                        "long basic_contract(const char *ID_name, const char "
-                       "*ID_name_out, int n1, int n2)");
+                       "*ID_name_out, int n1, int n2, int mode)");
 
     RegisterCLIcommand("imcontract3D",
                        __FILE__,
                        image_basic_contract3D_cli,
                        "image binning (3D)",
-                       "<inim> <outim> <binx> <biny> <binz>",
-                       "imcontracteD im1 outim 4 4 1",
+                       "<inim> <outim> <binx> <biny> <binz> "
+                       "<mode (sum/mean/min/max/median)>",
+                       "imcontract3D im1 outim 4 4 1 median",
                        "long basic_contract3D(const char *ID_name, const char "
-                       "*ID_name_out, int n1, int n2, int n3)");
+                       "*ID_name_out, int n1, int n2, int n3, int mode)");
+
+    RegisterCLIcommand("imrebin",
+                       __FILE__,
+                       image_basic_rebin_cli,
+                       "flux-conserving rebin to any size",
+                       "<inim> <outim> <xsizeout> <ysizeout>",
+                       "imrebin im1 outim 100 100",
+                       "long basic_rebin(const char *ID_name, const char "
+                       "*ID_name_out, long xsizeout, long ysizeout)");
 
     return RETURN_SUCCESS;
 }
 
-imageID
-basic_contract(const char *ID_name, const char *ID_name_out, int n1, int n2)
+// ==========================================
+// Row binning kernels
+// ==========================================
+
+typedef void (*IMCONTRACT_ROWKERNEL)(
+    void *out, const void *in, long nout, int n1, int nc);
+
+/* out[ii] += sum of in[ii * n1 + i], i < n1
+ * nc interleaved components per pixel (2 for complex), TA accumulator type
+ * n1 = 2 and 4 are specialized so that the compiler can vectorize them
+ */
+#define IMCONTRACT_ROW(TI, TA)                                                 \
+    static void imcontract_row_##TI(                                           \
+        void *outv, const void *inv, long nout, int n1, int nc)                \
+    {                                                                          \
+        TA *__restrict       out = (TA *) outv;                                \
+        const TI *__restrict in  = (const TI *) inv;                           \
+        if((nc == 1) && (n1 == 2))                                             \
+        {                                                                      \
+            for(long ii = 0; ii < nout; ii++)                                  \
+            {                                                                  \
+                out[ii] += (TA) in[2 * ii] + (TA) in[2 * ii + 1];              \
+            }                                                                  \
+        }                                                                      \
+        else if((nc == 1) && (n1 == 4))                                        \
+        {                                                                      \
+            for(long ii = 0; ii < nout; ii++)                                  \
+            {                                                                  \
+                out[ii] += ((TA) in[4 * ii] + (TA) in[4 * ii + 1]) +           \
+                           ((TA) in[4 * ii + 2] + (TA) in[4 * ii + 3]);        \
+            }                                                                  \
+        }                                                                      \
+        else                                                                   \
+        {                                                                      \
+            for(long ii = 0; ii < nout; ii++)                                  \
+            {                                                                  \
+                for(int c = 0; c < nc; c++)                                    \
+                {                                                              \
+                    TA val = 0;                                                \
+                    for(int i = 0; i < n1; i++)                                \
+                    {                                                          \
+                        val += (TA) in[(ii * n1 + i) * nc + c];                \
+                    }                                                          \
+                    out[ii * nc + c] += val;                                   \
+                }                                                              \
+            }                                                                  \
+        }                                                                      \
+    }
+
+IMCONTRACT_ROW(uint8_t, uint32_t)
+IMCONTRACT_ROW(int8_t, int32_t)
+IMCONTRACT_ROW(uint16_t, uint32_t)
+IMCONTRACT_ROW(int16_t, int32_t)
+IMCONTRACT_ROW(uint32_t, uint64_t)
+IMCONTRACT_ROW(int32_t, int64_t)
+IMCONTRACT_ROW(uint64_t, uint64_t)
+IMCONTRACT_ROW(int64_t, int64_t)
+IMCONTRACT_ROW(float, float)
+IMCONTRACT_ROW(double, double)
+
+#undef IMCONTRACT_ROW
+
+/* sum kernel and output (accumulator) datatype for input datatype
+ * integers are summed exactly in a wider integer, 8/16 bit into 32 bit,
+ * 32/64 bit into 64 bit. nc is set to the number of components per pixel.
+ * Returns 0 if datatype is not supported.
+ */
+static uint8_t
+imcontract_sumkernel(uint8_t datatype, IMCONTRACT_ROWKERNEL *kernel, int *nc)
 {
-    imageID  ID;
-    imageID  ID_out; /* ID for the output image */
-    uint32_t naxes[2], naxes_out[2];
-    int      i, j;
+    *nc = 1;
+    switch(datatype)
+    {
+        case _DATATYPE_UINT8:
+            *kernel = imcontract_row_uint8_t;
+            return _DATATYPE_UINT32;
+        case _DATATYPE_INT8:
+            *kernel = imcontract_row_int8_t;
+            return _DATATYPE_INT32;
+        case _DATATYPE_UINT16:
+            *kernel = imcontract_row_uint16_t;
+            return _DATATYPE_UINT32;
+        case _DATATYPE_INT16:
+            *kernel = imcontract_row_int16_t;
+            return _DATATYPE_INT32;
+        case _DATATYPE_UINT32:
+            *kernel = imcontract_row_uint32_t;
+            return _DATATYPE_UINT64;
+        case _DATATYPE_INT32:
+            *kernel = imcontract_row_int32_t;
+            return _DATATYPE_INT64;
+        case _DATATYPE_UINT64:
+            *kernel = imcontract_row_uint64_t;
+            return _DATATYPE_UINT64;
+        case _DATATYPE_INT64:
+            *kernel = imcontract_row_int64_t;
+            return _DATATYPE_INT64;
+        case _DATATYPE_FLOAT:
+            *kernel = imcontract_row_float;
+            return _DATATYPE_FLOAT;
+        case _DATATYPE_DOUBLE:
+            *kernel = imcontract_row_double;
+            return _DATATYPE_DOUBLE;
+        case _DATATYPE_COMPLEX_FLOAT:
+            *kernel = imcontract_row_float;
+            *nc     = 2;
+            return _DATATYPE_COMPLEX_FLOAT;
+        case _DATATYPE_COMPLEX_DOUBLE:
+            *kernel = imcontract_row_double;
+            *nc     = 2;
+            return _DATATYPE_COMPLEX_DOUBLE;
+    }
 
-    ID       = image_ID(ID_name);
-    naxes[0] = data.image[ID].md[0].size[0];
-    naxes[1] = data.image[ID].md[0].size[1];
+    return 0;
+}
+
+typedef void (*IMCONTRACT_EXTKERNEL)(
+    void *out, const void *in, long nout, int n1, int first);
+
+/* out[ii] = extremum of in[ii * n1 + i], i < n1, and of out[ii] unless first
+ * NAME is min or max, CMP the comparison selecting a over b
+ * n1 = 2 and 4 are specialized so that the compiler can vectorize them
+ */
+#define IMCONTRACT_EXT(NAME, CMP, TI)                                          \
+    static void imcontract_##NAME##_##TI(                                      \
+        void *outv, const void *inv, long nout, int n1, int first)             \
+    {                                                                          \
+        TI *__restrict       out = (TI *) outv;                                \
+        const TI *__restrict in  = (const TI *) inv;                           \
+        if(first == 1)                                                         \
+        {                                                                      \
+            for(long ii = 0; ii < nout; ii++)                                  \
+            {                                                                  \
+                out[ii] = in[ii * n1];                                         \
+            }                                                                  \
+        }                                                                      \
+        if(n1 == 2)                                                            \
+        {                                                                      \
+            for(long ii = 0; ii < nout; ii++)                                  \
+            {                                                                  \
+                TI a = in[2 * ii];                                             \
+                TI b = in[2 * ii + 1];                                         \
+                TI v = (a CMP b) ? a : b;                                      \
+                out[ii] = (v CMP out[ii]) ? v : out[ii];                       \
+            }                                                                  \
+        }                                                                      \
+        else if(n1 == 4)                                                       \
+        {                                                                      \
+            for(long ii = 0; ii < nout; ii++)                                  \
+            {                                                                  \
+                TI a = in[4 * ii];                                             \
+                TI b = in[4 * ii + 1];                                         \
+                TI c = in[4 * ii + 2];                                         \
+                TI d = in[4 * ii + 3];                                         \
+                TI v = (a CMP b) ? a : b;                                      \
+                TI w = (c CMP d) ? c : d;                                      \
+                v    = (v CMP w) ? v : w;                                      \
+                out[ii] = (v CMP out[ii]) ? v : out[ii];                       \
+            }                                                                  \
+        }                                                                      \
+        else                                                                   \
+        {                                                                      \
+            for(long ii = 0; ii < nout; ii++)                                  \
+            {                                                                  \
+                TI v = out[ii];                                                \
+                for(int i = 0; i < n1; i++)                                    \
+                {                                                              \
+                    v = (in[ii * n1 + i] CMP v) ? in[ii * n1 + i] : v;         \
+                }                                                              \
+                out[ii] = v;                                                   \
+            }                                                                  \
+        }                                                                      \
+    }
+
+// copy in[ii * n1 + i] to buf[ii * bs + offset + i], as double
+#define IMCONTRACT_GATHER(TI)                                                  \
+    static void imcontract_gather_##TI(                                        \
+        double *buf, const void *inv, long nout, int n1, int bs, int offset)   \
+    {                                                                          \
+        const TI *in = (const TI *) inv;                                       \
+        for(long ii = 0; ii < nout; ii++)                                      \
+        {                                                                      \
+            for(int i = 0; i < n1; i++)                                        \
+            {                                                                  \
+                buf[ii * bs + offset + i] = (double) in[ii * n1 + i];          \
+            }                                                                  \
+        }                                                                      \
+    }
+
+#define IMCONTRACT_PERTYPE(TI)                                                 \
+    IMCONTRACT_EXT(min, <, TI)                                                 \
+    IMCONTRACT_EXT(max, >, TI)                                                 \
+    IMCONTRACT_GATHER(TI)
+
+IMCONTRACT_PERTYPE(uint8_t)
+IMCONTRACT_PERTYPE(int8_t)
+IMCONTRACT_PERTYPE(uint16_t)
+IMCONTRACT_PERTYPE(int16_t)
+IMCONTRACT_PERTYPE(uint32_t)
+IMCONTRACT_PERTYPE(int32_t)
+IMCONTRACT_PERTYPE(uint64_t)
+IMCONTRACT_PERTYPE(int64_t)
+IMCONTRACT_PERTYPE(float)
+IMCONTRACT_PERTYPE(double)
 
-    naxes_out[0] = naxes[0] / n1;
-    naxes_out[1] = naxes[1] / n2;
+#undef IMCONTRACT_EXT
+#undef IMCONTRACT_GATHER
+#undef IMCONTRACT_PERTYPE
 
-    //  printf("%ld %ld  ->  %ld %ld\n",naxes[0],naxes[1],naxes_out[0],naxes_out[1]);
-    create_2Dimage_ID(ID_name_out, naxes_out[0], naxes_out[1], &ID_out);
+typedef void (*IMCONTRACT_GATHERKERNEL)(
+    double *buf, const void *in, long nout, int n1, int bs, int offset);
 
-    for(uint32_t jj = 0; jj < naxes_out[1]; jj++)
-        for(uint32_t ii = 0; ii < naxes_out[0]; ii++)
-            for(i = 0; i < n1; i++)
-                for(j = 0; j < n2; j++)
+// largest block size for which the median uses a sorting network
+#define IMCONTRACT_MEDIAN_MAXNET 64
+
+// comparator count of Batcher's network for IMCONTRACT_MEDIAN_MAXNET values
+#define IMCONTRACT_MEDIAN_MAXCMP 543
+
+/* sorting network computing the median of n <= IMCONTRACT_MEDIAN_MAXNET values
+ *
+ * Batcher's odd-even merge sort for the next power of 2, comparators beyond n
+ * dropped (as if padded with +inf), then pruned to those that can reach the
+ * central value(s). Returns the number of comparators written to cmp.
+ */
+static int imcontract_mediannet(int n, uint8_t cmp[][2])
+{
+    int    N     = 1;
+    int    NBcmp = 0;
+    int    NBkeep;
+    int8_t used[IMCONTRACT_MEDIAN_MAXNET] = {0};
+
+    while(N < n)
+    {
+        N *= 2;
+    }
+    for(int p = 1; p < N; p *= 2)
+    {
+        for(int k = p; k >= 1; k /= 2)
+        {
+            for(int j = k % p; j + k < N; j += 2 * k)
+            {
+                for(int i = 0; (i < k) && (i + j + k < N); i++)
                 {
-                    data.image[ID_out].array.F[jj * naxes_out[0] + ii] +=
-                        data.image[ID]
-                        .array.F[(jj * n2 + j) * naxes[0] + ii * n1 + i];
+                    if(((i + j) / (2 * p) == (i + j + k) / (2 * p)) &&
+                            (i + j + k < n))
+                    {
+                        cmp[NBcmp][0] = i + j;
+                        cmp[NBcmp][1] = i + j + k;
+                        NBcmp++;
+                    }
                 }
+            }
+        }
+    }
 
-    return (ID_out);
+    // keep comparators upstream of the central value(s), in order
+    used[(n - 1) / 2] = 1;
+    used[n / 2]       = 1;
+    NBkeep            = NBcmp;
+    for(int c = NBcmp - 1; c >= 0; c--)
+    {
+        if(used[cmp[c][0]] || used[cmp[c][1]])
+        {
+            used[cmp[c][0]] = 1;
+            used[cmp[c][1]] = 1;
+            NBkeep--;
+            cmp[NBkeep][0] = cmp[c][0];
+            cmp[NBkeep][1] = cmp[c][1];
+        }
+    }
+    memmove(cmp, cmp[NBkeep], sizeof(cmp[0]) * (NBcmp - NBkeep));
+
+    return NBcmp - NBkeep;
 }
 
-imageID basic_contract3D(
-    const char *ID_name, const char *ID_name_out, int n1, int n2, int n3)
+/* median of v[0..n-1], v is reordered
+ * cmp : network from imcontract_mediannet, used if n is small enough
+ * even n : mean of the two central values
+ */
+static double
+imcontract_median(double *v, int n, const uint8_t cmp[][2], int NBcmp)
 {
-    DEBUG_TRACE_FSTART();
+    int k = (n - 1) / 2;
 
-    imageID   ID;
-    imageID   ID_out; /* ID for the output image */
-    uint32_t  naxes[3];
-    uint32_t *naxes_out;
-    uint8_t   datatype;
+    if(n <= IMCONTRACT_MEDIAN_MAXNET)
+    {
+        // branchless compare-exchange
+        for(int c = 0; c < NBcmp; c++)
+        {
+            double a  = v[cmp[c][0]];
+            double b  = v[cmp[c][1]];
+            double lo = (a < b) ? a : b;
+            double hi = (b < a) ? a : b;
+            v[cmp[c][0]] = lo;
+            v[cmp[c][1]] = hi;
+        }
+        return 0.5 * (v[k] + v[n / 2]);
+    }
 
-    ID       = image_ID(ID_name);
-    datatype = data.image[ID].md[0].datatype;
-    naxes[0] = data.image[ID].md[0].size[0];
-    naxes[1] = data.image[ID].md[0].size[1];
-    naxes[2] = data.image[ID].md[0].size[2];
+    // Wirth selection of the k-th smallest value
+    {
+        int l = 0;
+        int m = n - 1;
+
+        while(l < m)
+        {
+            double x = v[k];
+            int    i = l;
+            int    j = m;
+            do
+            {
+                while(v[i] < x)
+                {
+                    i++;
+                }
+                while(x < v[j])
+                {
+                    j--;
+                }
+                if(i <= j)
+                {
+                    double tmp = v[i];
+                    v[i]       = v[j];
+                    v[j]       = tmp;
+                    i++;
+                    j--;
+                }
+            } while(i <= j);
+            if(j < k)
+            {
+                l = i;
+            }
+            if(k < i)
+            {
+                m = j;
+            }
+        }
+    }
 
-    naxes_out = (uint32_t *) malloc(sizeof(uint32_t) * 3);
-    if(naxes_out == NULL)
+    if(n % 2 == 1)
     {
-        PRINT_ERROR("malloc returns NULL pointer");
-        abort();
+        return v[k];
+    }
+    else
+    {
+        // values above k are all >= v[k], smallest of them is the upper one
+        double vup = v[k + 1];
+        for(int i = k + 2; i < n; i++)
+        {
+            vup = (v[i] < vup) ? v[i] : vup;
+        }
+        return 0.5 * (v[k] + vup);
+    }
+}
+
+/* out = scale x acc, converting sum type dtacc to output type dtout
+ * n values (2 per complex pixel), out and acc can be the same row
+ */
+static void imcontract_scale(void       *out,
+                             uint8_t     dtout,
+                             const void *acc,
+                             uint8_t     dtacc,
+                             long        n,
+                             double      scale)
+{
+#define IMCONTRACT_SCALE(TA)                                                   \
+    if((dtout == _DATATYPE_DOUBLE) || (dtout == _DATATYPE_COMPLEX_DOUBLE))     \
+    {                                                                          \
+        for(long ii = 0; ii < n; ii++)                                         \
+        {                                                                      \
+            ((double *) out)[ii] = scale * ((const TA *) acc)[ii];             \
+        }                                                                      \
+    }                                                                          \
+    else                                                                       \
+    {                                                                          \
+        for(long ii = 0; ii < n; ii++)                                         \
+        {                                                                      \
+            ((float *) out)[ii] = (float) scale * ((const TA *) acc)[ii];      \
+        }                                                                      \
+    }                                                                          \
+    break;
+
+    switch(dtacc)
+    {
+        case _DATATYPE_UINT32:
+            IMCONTRACT_SCALE(uint32_t)
+        case _DATATYPE_INT32:
+            IMCONTRACT_SCALE(int32_t)
+        case _DATATYPE_UINT64:
+            IMCONTRACT_SCALE(uint64_t)
+        case _DATATYPE_INT64:
+            IMCONTRACT_SCALE(int64_t)
+        case _DATATYPE_FLOAT:
+        case _DATATYPE_COMPLEX_FLOAT:
+            IMCONTRACT_SCALE(float)
+        case _DATATYPE_DOUBLE:
+        case _DATATYPE_COMPLEX_DOUBLE:
+            IMCONTRACT_SCALE(double)
+    }
+
+#undef IMCONTRACT_SCALE
+}
+
+/* set kernels of mode for input datatype
+ * returns output datatype, 0 if not supported
+ *
+ * sum       : see imcontract_sumkernel
+ * mean      : float for 8/16 bit integers and float, double otherwise,
+ *             complex kept
+ * min, max  : input datatype, real only
+ * median    : as mean, real only
+ */
+static uint8_t imcontract_kernels(uint8_t                  datatype,
+                                  int                      mode,
+                                  IMCONTRACT_ROWKERNEL    *sumkernel,
+                                  IMCONTRACT_EXTKERNEL    *extkernel,
+                                  IMCONTRACT_GATHERKERNEL *gatherkernel,
+                                  uint8_t                 *datatype_acc,
+                                  int                     *nc)
+{
+    *datatype_acc = imcontract_sumkernel(datatype, sumkernel, nc);
+    if(*datatype_acc == 0)
+    {
+        return 0;
+    }
+    if(mode == IMCONTRACT_MODE_SUM)
+    {
+        return *datatype_acc;
+    }
+    if((mode == IMCONTRACT_MODE_MEAN) && (*nc == 2))
+    {
+        return datatype;
+    }
+    if((*nc == 2) || (mode < 0) || (mode > IMCONTRACT_MODE_MEDIAN))
+    {
+        return 0;
+    }
+
+#define IMCONTRACT_KERNELS(TI)                                                 \
+    *extkernel = (mode == IMCONTRACT_MODE_MIN) ? imcontract_min_##TI           \
+                 : imcontract_max_##TI;                                        \
+    *gatherkernel = imcontract_gather_##TI;                                    \
+    break;
+
+    switch(datatype)
+    {
+        case _DATATYPE_UINT8:
+            IMCONTRACT_KERNELS(uint8_t)
+        case _DATATYPE_INT8:
+            IMCONTRACT_KERNELS(int8_t)
+        case _DATATYPE_UINT16:
+            IMCONTRACT_KERNELS(uint16_t)
+        case _DATATYPE_INT16:
+            IMCONTRACT_KERNELS(int16_t)
+        case _DATATYPE_UINT32:
+            IMCONTRACT_KERNELS(uint32_t)
+        case _DATATYPE_INT32:
+            IMCONTRACT_KERNELS(int32_t)
+        case _DATATYPE_UINT64:
+            IMCONTRACT_KERNELS(uint64_t)
+        case _DATATYPE_INT64:
+            IMCONTRACT_KERNELS(int64_t)
+        case _DATATYPE_FLOAT:
+            IMCONTRACT_KERNELS(float)
+        case _DATATYPE_DOUBLE:
+            IMCONTRACT_KERNELS(double)
+    }
+
+#undef IMCONTRACT_KERNELS
+
+    if((mode == IMCONTRACT_MODE_MIN) || (mode == IMCONTRACT_MODE_MAX))
+    {
+        return datatype;
+    }
+    switch(datatype)
+    {
+        case _DATATYPE_UINT8:
+        case _DATATYPE_INT8:
+        case _DATATYPE_UINT16:
+        case _DATATYPE_INT16:
+        case _DATATYPE_FLOAT:
+            return _DATATYPE_FLOAT;
+    }
+
+    return _DATATYPE_DOUBLE;
+}
+
+// ==========================================
+// Threads
+// ==========================================
+
+// max number of threads
+#define IMCONTRACT_MAXTHREAD 64
+
+// min input pixels per thread
+#define IMCONTRACT_MINTHREADPIX (256L * 1024)
+
+typedef struct
+{
+    const char             *in;
+    char                   *out;
+    int                     mode;
+    uint8_t                 datatype;     // output
+    uint8_t                 datatype_acc; // sum
+    size_t                  typesizein;
+    size_t                  typesizeout;
+    size_t                  typesizeacc;
+    IMCONTRACT_ROWKERNEL    sumkernel;
+    IMCONTRACT_EXTKERNEL    extkernel;
+    IMCONTRACT_GATHERKERNEL gatherkernel;
+    uint8_t                 mediancmp[IMCONTRACT_MEDIAN_MAXCMP][2];
+    int                     NBmediancmp;
+    int                     nc;
+    long                    naxes[3];
+    long                    naxesout[3];
+    int                     n1;
+    int                     n2;
+    int                     n3;
+    long                    rowstart; // output rows [rowstart, rowend),
+    long                    rowend;   // row index kk * naxesout[1] + jj
+} IMCONTRACT_PLAN;
+
+// median of each block of output row jj in plane kk, buf holds one row
+static void imcontract_medianrow(const IMCONTRACT_PLAN *plan,
+                                 long                   kk,
+                                 long                   jj,
+                                 double                *buf)
+{
+    long  planesize = plan->naxes[0] * plan->naxes[1];
+    int   bs        = plan->n1 * plan->n2 * plan->n3;
+    char *outrow    = plan->out + plan->typesizeout * plan->naxesout[0] *
+                   (kk * plan->naxesout[1] + jj);
+
+    for(int k = 0; k < plan->n3; k++)
+    {
+        for(int j = 0; j < plan->n2; j++)
+        {
+            plan->gatherkernel(buf,
+                               plan->in + plan->typesizein *
+                               ((kk * plan->n3 + k) * planesize +
+                                (jj * plan->n2 + j) * plan->naxes[0]),
+                               plan->naxesout[0],
+                               plan->n1,
+                               bs,
+                               (k * plan->n2 + j) * plan->n1);
+        }
+    }
+
+    for(long ii = 0; ii < plan->naxesout[0]; ii++)
+    {
+        double v = imcontract_median(
+            buf + ii * bs, bs, plan->mediancmp, plan->NBmediancmp);
+
+        if(plan->datatype == _DATATYPE_DOUBLE)
+        {
+            ((double *) outrow)[ii] = v;
+        }
+        else
+        {
+            ((float *) outrow)[ii] = (float) v;
+        }
+    }
+}
+
+/* bin output rows [rowstart, rowend)
+ * The n3 input planes of an output plane are read in turn, each input row
+ * once and in order, and reduced into the output row. Mean sums into acc
+ * (the output itself if of the sum type) and scales once the plane is done.
+ * Median gathers the n2 x n3 input rows of each output row.
+ */
+static void *imcontract_thread(void *ptr)
+{
+    IMCONTRACT_PLAN *plan       = (IMCONTRACT_PLAN *) ptr;
+    long             planesize  = plan->naxes[0] * plan->naxes[1];
+    long             rowsize    = plan->typesizeout * plan->naxesout[0];
+    long             rowsizeacc = plan->typesizeacc * plan->naxesout[0];
+    long             kkstart    = plan->rowstart / plan->naxesout[1];
+    long             kkend      = (plan->rowend - 1) / plan->naxesout[1];
+    char            *acc        = plan->out;
+    double          *buf        = NULL;
+
+    if(plan->rowend <= plan->rowstart)
+    {
+        return NULL;
+    }
+
+    if(plan->mode == IMCONTRACT_MODE_MEDIAN)
+    {
+        rowsizeacc = 0;
+        buf        = (double *) malloc(sizeof(double) * plan->naxesout[0] *
+                                plan->n1 * plan->n2 * plan->n3);
+        if(buf == NULL)
+        {
+            PRINT_ERROR("malloc returns NULL pointer");
+            abort();
+        }
+    }
+    else if((plan->mode == IMCONTRACT_MODE_MIN) ||
+            (plan->mode == IMCONTRACT_MODE_MAX))
+    {
+        rowsizeacc = 0;
+    }
+    else if(plan->datatype_acc != plan->datatype)
+    {
+        // acc row r at acc + rowsizeacc * (r - rowstart)
+        acc = (char *) malloc(rowsizeacc * (plan->rowend - plan->rowstart));
+        if(acc == NULL)
+        {
+            PRINT_ERROR("malloc returns NULL pointer");
+            abort();
+        }
+        acc -= rowsizeacc * plan->rowstart;
+    }
+    if(rowsizeacc > 0)
+    {
+        memset(acc + rowsizeacc * plan->rowstart,
+               0,
+               rowsizeacc * (plan->rowend - plan->rowstart));
+    }
+
+    for(long kk = kkstart; kk <= kkend; kk++)
+    {
+        // output rows of plane kk within [rowstart, rowend)
+        long jjstart = plan->rowstart - kk * plan->naxesout[1];
+        long jjend   = plan->rowend - kk * plan->naxesout[1];
+
+        if(jjstart < 0)
+        {
+            jjstart = 0;
+        }
+        if(jjend > plan->naxesout[1])
+        {
+            jjend = plan->naxesout[1];
+        }
+
+        if(plan->mode == IMCONTRACT_MODE_MEDIAN)
+        {
+            for(long jj = jjstart; jj < jjend; jj++)
+            {
+                imcontract_medianrow(plan, kk, jj, buf);
+            }
+            continue;
+        }
+
+        for(int k = 0; k < plan->n3; k++)
+        {
+            const char *inplane = plan->in + plan->typesizein *
+                                  (kk * plan->n3 + k) * planesize;
+
+            for(long jj = jjstart; jj < jjend; jj++)
+            {
+                long row = kk * plan->naxesout[1] + jj;
+
+                for(int j = 0; j < plan->n2; j++)
+                {
+                    const char *inrow = inplane + plan->typesizein *
+                                        (jj * plan->n2 + j) * plan->naxes[0];
+
+                    if(rowsizeacc > 0)
+                    {
+                        plan->sumkernel(acc + rowsizeacc * row,
+                                        inrow,
+                                        plan->naxesout[0],
+                                        plan->n1,
+                                        plan->nc);
+                    }
+                    else
+                    {
+                        plan->extkernel(plan->out + rowsize * row,
+                                        inrow,
+                                        plan->naxesout[0],
+                                        plan->n1,
+                                        (k == 0) && (j == 0));
+                    }
+                }
+            }
+        }
+
+        if(plan->mode == IMCONTRACT_MODE_MEAN)
+        {
+            for(long jj = jjstart; jj < jjend; jj++)
+            {
+                long row = kk * plan->naxesout[1] + jj;
+
+                imcontract_scale(plan->out + rowsize * row,
+                                 plan->datatype,
+                                 acc + rowsizeacc * row,
+                                 plan->datatype_acc,
+                                 plan->naxesout[0] * plan->nc,
+                                 1.0 / (plan->n1 * plan->n2 * plan->n3));
+            }
+        }
+    }
+
+    if(acc != plan->out)
+    {
+        free(acc + rowsizeacc * plan->rowstart);
+    }
+    free(buf);
+
+    return NULL;
+}
+
+/* run plan over its output rows, split in bands across threads
+ * bands are whole output planes when there are more planes than threads
+ * if a thread cannot be started, its band is run by the calling thread
+ */
+static void imcontract_run(const IMCONTRACT_PLAN *plan)
+{
+    IMCONTRACT_PLAN thread[IMCONTRACT_MAXTHREAD];
+    pthread_t       threadID[IMCONTRACT_MAXTHREAD];
+    long            NBrow    = plan->rowend - plan->rowstart;
+    long            NBpix    = NBrow * plan->n2 * plan->n3 * plan->naxes[0];
+    long            NBthread = sysconf(_SC_NPROCESSORS_ONLN);
+    long            NBstarted;
+    long            bandunit = 1; // rows, band edges are multiples of it
+
+    if(NBthread > NBpix / IMCONTRACT_MINTHREADPIX)
+    {
+        NBthread = NBpix / IMCONTRACT_MINTHREADPIX;
+    }
+    if(NBthread > NBrow)
+    {
+        NBthread = NBrow;
+    }
+    if(NBthread > IMCONTRACT_MAXTHREAD)
+    {
+        NBthread = IMCONTRACT_MAXTHREAD;
+    }
+    if(NBthread < 1)
+    {
+        NBthread = 1;
+    }
+
+    if((plan->rowstart % plan->naxesout[1] == 0) &&
+            (NBrow % plan->naxesout[1] == 0) &&
+            (NBrow / plan->naxesout[1] >= NBthread))
+    {
+        bandunit = plan->naxesout[1];
+    }
+
+    for(long t = 0; t < NBthread; t++)
+    {
+        thread[t]          = *plan;
+        thread[t].rowstart = plan->rowstart +
+                             bandunit * (NBrow / bandunit * t / NBthread);
+        thread[t].rowend   = plan->rowstart +
+                             bandunit * (NBrow / bandunit * (t + 1) / NBthread);
+    }
+    for(NBstarted = 1; NBstarted < NBthread; NBstarted++)
+    {
+        if(pthread_create(&threadID[NBstarted],
+                          NULL,
+                          imcontract_thread,
+                          &thread[NBstarted]) != 0)
+        {
+            printf("WARNING: pthread_create error, %ld of %ld threads\n",
+                   NBstarted,
+                   NBthread);
+            break;
+        }
+    }
+    imcontract_thread(&thread[0]);
+    for(long t = NBstarted; t < NBthread; t++)
+    {
+        imcontract_thread(&thread[t]);
+    }
+    for(long t = 1; t < NBstarted; t++)
+    {
+        pthread_join(threadID[t], NULL);
+    }
+}
+
+/* bin image ID into new image ID_name_out, n[3] bin sizes
+ * output is 2D if naxis_out is 2, or if it has a single plane
+ */
+static imageID imcontract_image(imageID     ID,
+                                const char *ID_name_out,
+                                int         naxis_out,
+                                const int  *n,
+                                int         mode)
+{
+    imageID         ID_out; /* ID for the output image */
+    uint32_t        naxes_out[3];
+    uint8_t         datatype;
+    IMCONTRACT_PLAN plan;
+
+    datatype      = data.image[ID].md[0].datatype;
+    plan.mode     = mode;
+    plan.datatype = imcontract_kernels(datatype,
+                                       mode,
+                                       &plan.sumkernel,
+                                       &plan.extkernel,
+                                       &plan.gatherkernel,
+                                       &plan.datatype_acc,
+                                       &plan.nc);
+    if(plan.datatype == 0)
+    {
+        PRINT_ERROR("datatype %d not supported in mode %d",
+                    (int) datatype,
+                    mode);
+        return -1;
+    }
+
+    for(int ax = 0; ax < 3; ax++)
+    {
+        plan.naxes[ax] = 1;
+        if(ax < data.image[ID].md[0].naxis)
+        {
+            plan.naxes[ax] = data.image[ID].md[0].size[ax];
+        }
+    }
+    if(naxis_out == 2)
+    {
+        plan.naxes[2] = 1;
+    }
+    plan.n1 = n[0];
+    plan.n2 = n[1];
+    plan.n3 = n[2];
+    if((mode == IMCONTRACT_MODE_MEDIAN) &&
+            (n[0] * n[1] * n[2] <= IMCONTRACT_MEDIAN_MAXNET))
+    {
+        plan.NBmediancmp =
+            imcontract_mediannet(n[0] * n[1] * n[2], plan.mediancmp);
+    }
+    for(int ax = 0; ax < 3; ax++)
+    {
+        plan.naxesout[ax] = plan.naxes[ax] / n[ax];
+        naxes_out[ax]     = plan.naxesout[ax];
     }
-    naxes_out[0] = naxes[0] / n1;
-    naxes_out[1] = naxes[1] / n2;
-    naxes_out[2] = naxes[2] / n3;
 
     if(naxes_out[2] == 1)
     {
-        create_2Dimage_ID(ID_name_out, naxes_out[0], naxes_out[1], NULL);
+        naxis_out = 2;
     }
     else
     {
         printf("(%ld x %ld x %ld)  ->  (%ld x %ld x %ld)\n",
-               (long) naxes[0],
-               (long) naxes[1],
-               (long) naxes[2],
-               (long) naxes_out[0],
-               (long) naxes_out[1],
-               (long) naxes_out[2]);
-        create_image_ID(ID_name_out, 3, naxes_out, datatype, 0, 0, 0, NULL);
+               plan.naxes[0],
+               plan.naxes[1],
+               plan.naxes[2],
+               plan.naxesout[0],
+               plan.naxesout[1],
+               plan.naxesout[2]);
     }
+    create_image_ID(
+        ID_name_out, naxis_out, naxes_out, plan.datatype, 0, 0, 0, &ID_out);
 
-    ID_out = image_ID(ID_name_out);
+    plan.in          = (const char *) data.image[ID].array.raw;
+    plan.out         = (char *) data.image[ID_out].array.raw;
+    plan.typesizein  = ImageStreamIO_typesize(datatype);
+    plan.typesizeout = ImageStreamIO_typesize(plan.datatype);
+    plan.typesizeacc = ImageStreamIO_typesize(plan.datatype_acc);
+    plan.rowstart    = 0;
+    plan.rowend      = plan.naxesout[1] * plan.naxesout[2];
+    imcontract_run(&plan);
+
+    return ID_out;
+}
+
+/* n1 x n2 pixel binning
+ *
+ * mode : IMCONTRACT_MODE_SUM, MEAN, MIN, MAX or MEDIAN
+ * Edge pixels not filling a full bin are dropped. Output type follows
+ * imcontract_kernels : sums of integer types use a wider integer type, mean
+ * and median are float or double, min and max keep the input type.
+ */
+imageID basic_contract(
+    const char *ID_name, const char *ID_name_out, int n1, int n2, int mode)
+{
+    int n[3] = {n1, n2, 1};
+
+    return imcontract_image(image_ID(ID_name), ID_name_out, 2, n, mode);
+}
+
+/* n1 x n2 x n3 voxel binning
+ *
+ * Same modes and output types as basic_contract. Output is 2D if it has a
+ * single plane, 3D otherwise.
+ */
+imageID basic_contract3D(const char *ID_name,
+                         const char *ID_name_out,
+                         int         n1,
+                         int         n2,
+                         int         n3,
+                         int         mode)
+{
+    DEBUG_TRACE_FSTART();
+
+    imageID ID_out;
+    int     n[3] = {n1, n2, n3};
+
+    ID_out = imcontract_image(image_ID(ID_name), ID_name_out, 3, n, mode);
+
+    DEBUG_TRACE_FEXIT();
+
+    return (ID_out);
+}
+
+/* add n1 x n2 binned frame in to out, same binning as basic_contract
+ *
+ * in  : xsize x ysize frame, any real datatype
+ * out : (xsize/n1) x (ysize/n2) accumulator, edge pixels not filling a
+ *       full bin are dropped
+ *
+ * Accumulates, so that K frames can be coadded by K calls on the same
+ * output. Used to bin stream frames without creating an image.
+ */
+errno_t basic_contract_frame_add(double     *out,
+                                 const void *in,
+                                 uint8_t     datatype,
+                                 uint32_t    xsize,
+                                 uint32_t    ysize,
+                                 int         n1,
+                                 int         n2)
+{
+    uint32_t xsize_out = xsize / n1;
+    uint32_t ysize_out = ysize / n2;
+
+#define CONTRACT_FRAME_ADD(type)                                               \
+    for(uint32_t jj = 0; jj < ysize_out; jj++)                                 \
+    {                                                                          \
+        double *outrow = out + (uint64_t) jj * xsize_out;                      \
+        for(int j = 0; j < n2; j++)                                            \
+        {                                                                      \
+            const type *inrow =                                                \
+                (const type *) in + (uint64_t)(jj * n2 + j) * xsize;           \
+            for(uint32_t ii = 0; ii < xsize_out; ii++)                         \
+            {                                                                  \
+                double val = 0.0;                                              \
+                for(int i = 0; i < n1; i++)                                    \
+                {                                                              \
+                    val += inrow[ii * n1 + i];                                 \
+                }                                                              \
+                outrow[ii] += val;                                             \
+            }                                                                  \
+        }                                                                      \
+    }                                                                          \
+    break;
 
     switch(datatype)
     {
+        case _DATATYPE_UINT8:
+            CONTRACT_FRAME_ADD(uint8_t)
+        case _DATATYPE_INT8:
+            CONTRACT_FRAME_ADD(int8_t)
+        case _DATATYPE_UINT16:
+            CONTRACT_FRAME_ADD(uint16_t)
+        case _DATATYPE_INT16:
+            CONTRACT_FRAME_ADD(int16_t)
+        case _DATATYPE_UINT32:
+            CONTRACT_FRAME_ADD(uint32_t)
+        case _DATATYPE_INT32:
+            CONTRACT_FRAME_ADD(int32_t)
+        case _DATATYPE_UINT64:
+            CONTRACT_FRAME_ADD(uint64_t)
+        case _DATATYPE_INT64:
+            CONTRACT_FRAME_ADD(int64_t)
         case _DATATYPE_FLOAT:
-            for(uint32_t jj = 0; jj < naxes_out[1]; jj++)
-                for(uint32_t ii = 0; ii < naxes_out[0]; ii++)
-                    for(uint32_t kk = 0; kk < naxes_out[2]; kk++)
-                        for(int i = 0; i < n1; i++)
-                            for(int j = 0; j < n2; j++)
-                                for(int k = 0; k < n3; k++)
-                                {
-                                    data.image[ID_out]
-                                    .array.F[kk * naxes_out[0] * naxes_out[1] +
-                                                jj * naxes_out[0] + ii] +=
-                                                 data.image[ID]
-                                                 .array
-                                                 .F[(kk * n3 + k) * naxes[0] * naxes[1] +
-                                                                  (jj * n2 + j) * naxes[0] + ii * n1 +
-                                                                  i];
-                                }
+            CONTRACT_FRAME_ADD(float)
+        case _DATATYPE_DOUBLE:
+            CONTRACT_FRAME_ADD(double)
+        default:
+            PRINT_ERROR("datatype %d not supported", (int) datatype);
+            return RETURN_FAILURE;
+    }
+
+#undef CONTRACT_FRAME_ADD
+
+    return RETURN_SUCCESS;
+}
+
+// ==========================================
+// Non-integer rebinning
+// ==========================================
+
+// tmp[ii] += w * in[ii]
+#define IMCONTRACT_WACC(TI)                                                    \
+    static void imcontract_wacc_##TI(                                          \
+        double *tmp, const void *inv, long n, double w)                        \
+    {                                                                          \
+        const TI *__restrict in = (const TI *) inv;                            \
+        for(long ii = 0; ii < n; ii++)                                         \
+        {                                                                      \
+            tmp[ii] += w * in[ii];                                             \
+        }                                                                      \
+    }
+
+IMCONTRACT_WACC(uint8_t)
+IMCONTRACT_WACC(int8_t)
+IMCONTRACT_WACC(uint16_t)
+IMCONTRACT_WACC(int16_t)
+IMCONTRACT_WACC(uint32_t)
+IMCONTRACT_WACC(int32_t)
+IMCONTRACT_WACC(uint64_t)
+IMCONTRACT_WACC(int64_t)
+IMCONTRACT_WACC(float)
+IMCONTRACT_WACC(double)
+
+#undef IMCONTRACT_WACC
+
+typedef struct
+{
+    const IMAGE_BASIC_REBINPLAN *plan;
+    void                        *out;
+    uint8_t                      datatype_out;
+    const char                  *in;
+    size_t                       typesizein;
+    void (*wacc)(double *tmp, const void *in, long n, double w);
+    double                      *tmp;
+    long                         rowstart; // output rows [rowstart, rowend)
+    long                         rowend;
+} IMCONTRACT_REBINTHREAD;
+
+// vertical then horizontal sparse pass for output rows [rowstart, rowend)
+static void *imcontract_rebin_thread(void *ptr)
+{
+    IMCONTRACT_REBINTHREAD      *thread = (IMCONTRACT_REBINTHREAD *) ptr;
+    const IMAGE_BASIC_REBINPLAN *plan   = thread->plan;
+
+    for(long jj = thread->rowstart; jj < thread->rowend; jj++)
+    {
+        const double *wy = plan->w[1] + jj * plan->NBwmax[1];
+
+        memset(thread->tmp, 0, sizeof(double) * plan->naxes[0]);
+        for(int j = 0; j < plan->NBw[1][jj]; j++)
+        {
+            thread->wacc(thread->tmp,
+                         thread->in + thread->typesizein *
+                         (plan->start[1][jj] + j) * plan->naxes[0],
+                         plan->naxes[0],
+                         wy[j]);
+        }
+
+        for(long ii = 0; ii < plan->naxesout[0]; ii++)
+        {
+            const double *wx  = plan->w[0] + ii * plan->NBwmax[0];
+            const double *row = thread->tmp + plan->start[0][ii];
+            double        v   = 0.0;
+
+            for(int i = 0; i < plan->NBw[0][ii]; i++)
+            {
+                v += wx[i] * row[i];
+            }
+            if(thread->datatype_out == _DATATYPE_DOUBLE)
+            {
+                ((double *) thread->out)[jj * plan->naxesout[0] + ii] = v;
+            }
+            else
+            {
+                ((float *) thread->out)[jj * plan->naxesout[0] + ii] = v;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* prepare rebinning of xsize x ysize frames to xsizeout x ysizeout
+ *
+ * Each output pixel covers xsize/xsizeout x ysize/ysizeout input pixels.
+ * Along each axis, an input pixel contributes to an output pixel with
+ * weight equal to their overlap, in input pixel units, so that the total
+ * flux is conserved. Integer factors give the same result as basic_contract
+ * in sum mode. Weights and the per-thread scratch rows are computed once
+ * here; image_basic_rebin_apply only does the weighted sums.
+ */
+errno_t image_basic_rebin_init(IMAGE_BASIC_REBINPLAN *plan,
+                               long                   xsize,
+                               long                   ysize,
+                               long                   xsizeout,
+                               long                   ysizeout)
+{
+    plan->naxes[0]    = xsize;
+    plan->naxes[1]    = ysize;
+    plan->naxesout[0] = xsizeout;
+    plan->naxesout[1] = ysizeout;
+    if((xsize < 1) || (ysize < 1) || (xsizeout < 1) || (ysizeout < 1))
+    {
+        PRINT_ERROR("invalid rebin size %ld x %ld -> %ld x %ld",
+                    xsize,
+                    ysize,
+                    xsizeout,
+                    ysizeout);
+        return RETURN_FAILURE;
+    }
+
+    for(int ax = 0; ax < 2; ax++)
+    {
+        long nin  = plan->naxes[ax];
+        long nout = plan->naxesout[ax];
+
+        plan->NBwmax[ax] = (nin + nout - 1) / nout + 1;
+        plan->start[ax]  = (long *) malloc(sizeof(long) * nout);
+        plan->NBw[ax]    = (int *) malloc(sizeof(int) * nout);
+        plan->w[ax] =
+            (double *) malloc(sizeof(double) * nout * plan->NBwmax[ax]);
+        if((plan->start[ax] == NULL) || (plan->NBw[ax] == NULL) ||
+                (plan->w[ax] == NULL))
+        {
+            PRINT_ERROR("malloc returns NULL pointer");
+            abort();
+        }
+
+        for(long o = 0; o < nout; o++)
+        {
+            // output pixel o covers input [x0, x1)
+            double x0 = (double) o * nin / nout;
+            double x1 = (double)(o + 1) * nin / nout;
+            long   i0 = (long) x0;
+            long   i1 = (long) ceil(x1);
+            int    NBw = 0;
+
+            if(i1 > nin)
+            {
+                i1 = nin;
+            }
+            plan->start[ax][o] = i0;
+            for(long i = i0; i < i1; i++)
+            {
+                double lo = (x0 > i) ? x0 : i;
+                double hi = (x1 < i + 1) ? x1 : i + 1;
+
+                plan->w[ax][o * plan->NBwmax[ax] + NBw] = hi - lo;
+                NBw++;
+            }
+            plan->NBw[ax][o] = NBw;
+        }
+    }
+
+    plan->NBthread = sysconf(_SC_NPROCESSORS_ONLN);
+    if(plan->NBthread > xsize * ysize / IMCONTRACT_MINTHREADPIX)
+    {
+        plan->NBthread = xsize * ysize / IMCONTRACT_MINTHREADPIX;
+    }
+    if(plan->NBthread > ysizeout)
+    {
+        plan->NBthread = ysizeout;
+    }
+    if(plan->NBthread > IMCONTRACT_MAXTHREAD)
+    {
+        plan->NBthread = IMCONTRACT_MAXTHREAD;
+    }
+    if(plan->NBthread < 1)
+    {
+        plan->NBthread = 1;
+    }
+    plan->tmp = (double *) malloc(sizeof(double) * xsize * plan->NBthread);
+    if(plan->tmp == NULL)
+    {
+        PRINT_ERROR("malloc returns NULL pointer");
+        abort();
+    }
+
+    return RETURN_SUCCESS;
+}
+
+/* rebin frame in to out with plan
+ *
+ * in  : any real datatype
+ * out : float or double
+ * The same plan may be applied to any number of frames, but not
+ * concurrently, as it holds the scratch rows.
+ */
+errno_t image_basic_rebin_apply(const IMAGE_BASIC_REBINPLAN *plan,
+                                void                        *out,
+                                uint8_t                      datatype_out,
+                                const void                  *in,
+                                uint8_t                      datatype)
+{
+    IMCONTRACT_REBINTHREAD thread[IMCONTRACT_MAXTHREAD];
+    pthread_t              threadID[IMCONTRACT_MAXTHREAD];
+    int                    NBstarted;
+    void (*wacc)(double *tmp, const void *in, long n, double w);
+
+    switch(datatype)
+    {
+        case _DATATYPE_UINT8:
+            wacc = imcontract_wacc_uint8_t;
+            break;
+        case _DATATYPE_INT8:
+            wacc = imcontract_wacc_int8_t;
+            break;
+        case _DATATYPE_UINT16:
+            wacc = imcontract_wacc_uint16_t;
+            break;
+        case _DATATYPE_INT16:
+            wacc = imcontract_wacc_int16_t;
+            break;
+        case _DATATYPE_UINT32:
+            wacc = imcontract_wacc_uint32_t;
+            break;
+        case _DATATYPE_INT32:
+            wacc = imcontract_wacc_int32_t;
+            break;
+        case _DATATYPE_UINT64:
+            wacc = imcontract_wacc_uint64_t;
+            break;
+        case _DATATYPE_INT64:
+            wacc = imcontract_wacc_int64_t;
+            break;
+        case _DATATYPE_FLOAT:
+            wacc = imcontract_wacc_float;
             break;
         case _DATATYPE_DOUBLE:
-            for(uint32_t jj = 0; jj < naxes_out[1]; jj++)
-                for(uint32_t ii = 0; ii < naxes_out[0]; ii++)
-                    for(uint32_t kk = 0; kk < naxes_out[2]; kk++)
-                        for(int i = 0; i < n1; i++)
-                            for(int j = 0; j < n2; j++)
-                                for(int k = 0; k < n3; k++)
-                                {
-                                    data.image[ID_out]
-                                    .array.D[kk * naxes_out[0] * naxes_out[1] +
-                                                jj * naxes_out[0] + ii] +=
-                                                 data.image[ID]
-                                                 .array
-                                                 .D[(kk * n3 + k) * naxes[0] * naxes[1] +
-                                                                  (jj * n2 + j) * naxes[0] + ii * n1 +
-                                                                  i];
-                                }
+            wacc = imcontract_wacc_double;
             break;
-        case _DATATYPE_COMPLEX_FLOAT:
-            for(uint32_t jj = 0; jj < naxes_out[1]; jj++)
-                for(uint32_t ii = 0; ii < naxes_out[0]; ii++)
-                    for(uint32_t kk = 0; kk < naxes_out[2]; kk++)
-                        for(int i = 0; i < n1; i++)
-                            for(int j = 0; j < n2; j++)
-                                for(int k = 0; k < n3; k++)
-                                {
-                                    data.image[ID_out]
-                                    .array
-                                    .CF[kk * naxes_out[0] * naxes_out[1] +
-                                           jj * naxes_out[0] + ii]
-                                    .re += data.image[ID]
-                                           .array
-                                           .CF[(kk * n3 + k) * naxes[0] *
-                                                             naxes[1] +
-                                                             (jj * n2 + j) * naxes[0] +
-                                                             ii * n1 + i]
-                                           .re;
-                                    data.image[ID_out]
-                                    .array
-                                    .CF[kk * naxes_out[0] * naxes_out[1] +
-                                           jj * naxes_out[0] + ii]
-                                    .im += data.image[ID]
-                                           .array
-                                           .CF[(kk * n3 + k) * naxes[0] *
-                                                             naxes[1] +
-                                                             (jj * n2 + j) * naxes[0] +
-                                                             ii * n1 + i]
-                                           .im;
-                                }
+        default:
+            PRINT_ERROR("datatype %d not supported", (int) datatype);
+            return RETURN_FAILURE;
+    }
+    if((datatype_out != _DATATYPE_FLOAT) && (datatype_out != _DATATYPE_DOUBLE))
+    {
+        PRINT_ERROR("output datatype %d not supported", (int) datatype_out);
+        return RETURN_FAILURE;
+    }
+
+    for(int t = 0; t < plan->NBthread; t++)
+    {
+        thread[t].plan         = plan;
+        thread[t].out          = out;
+        thread[t].datatype_out = datatype_out;
+        thread[t].in           = (const char *) in;
+        thread[t].typesizein   = ImageStreamIO_typesize(datatype);
+        thread[t].wacc         = wacc;
+        thread[t].tmp          = plan->tmp + t * plan->naxes[0];
+        thread[t].rowstart     = plan->naxesout[1] * t / plan->NBthread;
+        thread[t].rowend       = plan->naxesout[1] * (t + 1) / plan->NBthread;
+    }
+    // bands of threads that cannot be started are run by the calling thread
+    for(NBstarted = 1; NBstarted < plan->NBthread; NBstarted++)
+    {
+        if(pthread_create(&threadID[NBstarted],
+                          NULL,
+                          imcontract_rebin_thread,
+                          &thread[NBstarted]) != 0)
+        {
+            printf("WARNING: pthread_create error, %d of %d threads\n",
+                   NBstarted,
+                   plan->NBthread);
             break;
-        case _DATATYPE_COMPLEX_DOUBLE:
-            for(uint32_t jj = 0; jj < naxes_out[1]; jj++)
-                for(uint32_t ii = 0; ii < naxes_out[0]; ii++)
-                    for(uint32_t kk = 0; kk < naxes_out[2]; kk++)
-                        for(int i = 0; i < n1; i++)
-                            for(int j = 0; j < n2; j++)
-                                for(int k = 0; k < n3; k++)
-                                {
-                                    data.image[ID_out]
-                                    .array
-                                    .CD[kk * naxes_out[0] * naxes_out[1] +
-                                           jj * naxes_out[0] + ii]
-                                    .re += data.image[ID]
-                                           .array
-                                           .CD[(kk * n3 + k) * naxes[0] *
-                                                             naxes[1] +
-                                                             (jj * n2 + j) * naxes[0] +
-                                                             ii * n1 + i]
-                                           .re;
-                                    data.image[ID_out]
-                                    .array
-                                    .CD[kk * naxes_out[0] * naxes_out[1] +
-                                           jj * naxes_out[0] + ii]
-                                    .im += data.image[ID]
-                                           .array
-                                           .CD[(kk * n3 + k) * naxes[0] *
-                                                             naxes[1] +
-                                                             (jj * n2 + j) * naxes[0] +
-                                                             ii * n1 + i]
-                                           .im;
-                                }
+        }
+    }
+    imcontract_rebin_thread(&thread[0]);
+    for(int t = NBstarted; t < plan->NBthread; t++)
+    {
+        imcontract_rebin_thread(&thread[t]);
+    }
+    for(int t = 1; t < NBstarted; t++)
+    {
+        pthread_join(threadID[t], NULL);
+    }
+
+    return RETURN_SUCCESS;
+}
+
+void image_basic_rebin_free(IMAGE_BASIC_REBINPLAN *plan)
+{
+    for(int ax = 0; ax < 2; ax++)
+    {
+        free(plan->start[ax]);
+        free(plan->NBw[ax]);
+        free(plan->w[ax]);
+    }
+    free(plan->tmp);
+}
+
+/* flux-conserving rebin of image ID_name to xsizeout x ysizeout
+ *
+ * 3D images are rebinned plane by plane with a single plan. Output is float,
+ * double if the input is double or a 32/64 bit integer.
+ */
+imageID basic_rebin(const char *ID_name,
+                    const char *ID_name_out,
+                    long        xsizeout,
+                    long        ysizeout)
+{
+    imageID               ID;
+    imageID               ID_out;
+    IMAGE_BASIC_REBINPLAN plan;
+    uint8_t               datatype, datatype_out;
+    uint32_t              naxes_out[3];
+    long                  naxes[3] = {1, 1, 1};
+    size_t                planesize, planesizeout;
+
+    ID       = image_ID(ID_name);
+    datatype = data.image[ID].md[0].datatype;
+    for(int ax = 0; (ax < 3) && (ax < data.image[ID].md[0].naxis); ax++)
+    {
+        naxes[ax] = data.image[ID].md[0].size[ax];
+    }
+
+    switch(datatype)
+    {
+        case _DATATYPE_UINT8:
+        case _DATATYPE_INT8:
+        case _DATATYPE_UINT16:
+        case _DATATYPE_INT16:
+        case _DATATYPE_FLOAT:
+            datatype_out = _DATATYPE_FLOAT;
+            break;
+        case _DATATYPE_UINT32:
+        case _DATATYPE_INT32:
+        case _DATATYPE_UINT64:
+        case _DATATYPE_INT64:
+        case _DATATYPE_DOUBLE:
+            datatype_out = _DATATYPE_DOUBLE;
             break;
+        default:
+            PRINT_ERROR("datatype %d not supported", (int) datatype);
+            return -1;
     }
 
-    free(naxes_out);
+    if(image_basic_rebin_init(&plan, naxes[0], naxes[1], xsizeout, ysizeout) !=
+            RETURN_SUCCESS)
+    {
+        return -1;
+    }
 
-    DEBUG_TRACE_FEXIT();
+    naxes_out[0] = xsizeout;
+    naxes_out[1] = ysizeout;
+    naxes_out[2] = naxes[2];
+    create_image_ID(ID_name_out,
+                    (naxes[2] > 1) ? 3 : 2,
+                    naxes_out,
+                    datatype_out,
+                    0,
+                    0,
+                    0,
+                    &ID_out);
 
-    return (ID_out);
+    planesize    = ImageStreamIO_typesize(datatype) * naxes[0] * naxes[1];
+    planesizeout = ImageStreamIO_typesize(datatype_out) * xsizeout * ysizeout;
+    for(long kk = 0; kk < naxes[2]; kk++)
+    {
+        if(image_basic_rebin_apply(
+                    &plan,
+                    (char *) data.image[ID_out].array.raw + kk * planesizeout,
+                    datatype_out,
+                    (const char *) data.image[ID].array.raw + kk * planesize,
+                    datatype) != RETURN_SUCCESS)
+        {
+            image_basic_rebin_free(&plan);
+            delete_image_ID(ID_name_out, DELETE_IMAGE_ERRMODE_WARNING);
+            return -1;
+        }
+    }
+
+    image_basic_rebin_free(&plan);
+
+    return ID_out;
 }
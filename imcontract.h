@@ -1,10 +1,61 @@
 /** @file imcontract.h
  */
 
+// binning modes of basic_contract and basic_contract3D
+#define IMCONTRACT_MODE_SUM    0
+#define IMCONTRACT_MODE_MEAN   1
+#define IMCONTRACT_MODE_MIN    2
+#define IMCONTRACT_MODE_MAX    3
+#define IMCONTRACT_MODE_MEDIAN 4
+
+// separable area-overlap weights for rebinning to a non-integer factor
+typedef struct
+{
+    long    naxes[2];    // input size
+    long    naxesout[2]; // output size
+    int     NBwmax[2];   // max input pixels per output pixel, per axis
+    long   *start[2];    // first input pixel of each output pixel
+    int    *NBw[2];      // number of input pixels of each output pixel
+    double *w[2];        // NBwmax[ax] weights per output pixel
+    int     NBthread;
+    double *tmp; // NBthread rows of vertically binned input
+} IMAGE_BASIC_REBINPLAN;
+
 errno_t imcontract_addCLIcmd();
 
-imageID
-basic_contract(const char *ID_name, const char *ID_name_out, int n1, int n2);
+imageID basic_contract(
+    const char *ID_name, const char *ID_name_out, int n1, int n2, int mode);
+
+imageID basic_contract3D(const char *ID_name,
+                         const char *ID_name_out,
+                         int         n1,
+                         int         n2,
+                         int         n3,
+                         int         mode);
+
+errno_t basic_contract_frame_add(double     *out,
+                                 const void *in,
+                                 uint8_t     datatype,
+                                 uint32_t    xsize,
+                                 uint32_t    ysize,
+                                 int         n1,
+                                 int         n2);
+
+errno_t image_basic_rebin_init(IMAGE_BASIC_REBINPLAN *plan,
+                               long                   xsize,
+                               long                   ysize,
+                               long                   xsizeout,
+                               long                   ysizeout);
+
+errno_t image_basic_rebin_apply(const IMAGE_BASIC_REBINPLAN *plan,
+                                void                        *out,
+                                uint8_t                      datatype_out,
+                                const void                  *in,
+                                uint8_t                      datatype);
+
+void image_basic_rebin_free(IMAGE_BASIC_REBINPLAN *plan);
 
-imageID basic_contract3D(
-    const char *ID_name, const char *ID_name_out, int n1, int n2, int n3);
+imageID basic_rebin(const char *ID_name,
+                    const char *ID_name_out,
+                    long        xsizeout,
+                    long        ysizeout);
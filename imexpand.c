@@ -1,6 +1,8 @@
 /** @file imexpand.c
  */
 
+#include <pthread.h>
+
 #include "CommandLineInterface/CLIcore.h"
 
 #include "COREMOD_memory/COREMOD_memory.h"
@@ -85,51 +87,260 @@ errno_t imexpand_addCLIcmd()
     return RETURN_SUCCESS;
 }
 
-/* expand image by factor n1 along x axis and n2 along y axis */
+// ==========================================
+// Row expansion kernels
+// ==========================================
+
+// max number of threads
+#define IMEXPAND_MAXTHREAD 64
+
+// min output pixels per thread
+#define IMEXPAND_MINTHREADPIX (256L * 1024)
+
+// 16-byte pixel (complex double)
+typedef struct
+{
+    uint64_t v[2];
+} IMEXPAND_PIX16;
+
+typedef void (*IMEXPAND_ROWKERNEL)(void *out, const void *in, long n, int n1);
+
+/* out[ii * n1 + i] = in[ii], i < n1
+ * pixels are copied by size, so one kernel serves all types of that size
+ * n1 = 2 is specialized so that the compiler can vectorize it
+ */
+#define IMEXPAND_ROW(T)                                                        \
+    static void imexpand_row_##T(void *outv, const void *inv, long n, int n1)  \
+    {                                                                          \
+        T *__restrict       out = (T *) outv;                                  \
+        const T *__restrict in  = (const T *) inv;                             \
+        if(n1 == 2)                                                            \
+        {                                                                      \
+            for(long ii = 0; ii < n; ii++)                                     \
+            {                                                                  \
+                out[2 * ii]     = in[ii];                                      \
+                out[2 * ii + 1] = in[ii];                                      \
+            }                                                                  \
+        }                                                                      \
+        else                                                                   \
+        {                                                                      \
+            for(long ii = 0; ii < n; ii++)                                     \
+            {                                                                  \
+                T v = in[ii];                                                  \
+                for(int i = 0; i < n1; i++)                                    \
+                {                                                              \
+                    out[ii * n1 + i] = v;                                      \
+                }                                                              \
+            }                                                                  \
+        }                                                                      \
+    }
+
+IMEXPAND_ROW(uint8_t)
+IMEXPAND_ROW(uint16_t)
+IMEXPAND_ROW(uint32_t)
+IMEXPAND_ROW(uint64_t)
+IMEXPAND_ROW(IMEXPAND_PIX16)
+
+#undef IMEXPAND_ROW
+
+typedef struct
+{
+    const char        *in;
+    char              *out;
+    size_t             typesize;
+    IMEXPAND_ROWKERNEL kernel;
+    long               naxes[3];
+    long               naxesout[3];
+    int                n1;
+    int                n2;
+    int                n3;
+    long               rowstart; // input rows [rowstart, rowend),
+    long               rowend;   // row index kk * naxes[1] + jj
+} IMEXPAND_PLAN;
+
+/* expand input rows [rowstart, rowend)
+ * Each input row is expanded once along x into the first of its output
+ * rows, which is then copied to the other n2 - 1 rows of the same plane and
+ * to the same rows of the other n3 - 1 planes.
+ */
+static void *imexpand_thread(void *ptr)
+{
+    IMEXPAND_PLAN *plan      = (IMEXPAND_PLAN *) ptr;
+    size_t         rowsize   = plan->typesize * plan->naxesout[0];
+    size_t         planesize = rowsize * plan->naxesout[1];
+
+    for(long row = plan->rowstart; row < plan->rowend; row++)
+    {
+        long  kk     = row / plan->naxes[1];
+        long  jj     = row % plan->naxes[1];
+        char *outrow = plan->out + planesize * kk * plan->n3 +
+                       rowsize * jj * plan->n2;
+
+        plan->kernel(outrow,
+                     plan->in + plan->typesize * row * plan->naxes[0],
+                     plan->naxes[0],
+                     plan->n1);
+        for(int k = 0; k < plan->n3; k++)
+        {
+            for(int j = 0; j < plan->n2; j++)
+            {
+                if((k > 0) || (j > 0))
+                {
+                    memcpy(outrow + planesize * k + rowsize * j,
+                           outrow,
+                           rowsize);
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// expand image ID into ID_out, of same datatype and size n[ax] * naxes[ax]
+static void
+imexpand_run(imageID ID, imageID ID_out, const long *naxes, const int *n)
+{
+    IMEXPAND_PLAN plan;
+    IMEXPAND_PLAN thread[IMEXPAND_MAXTHREAD];
+    pthread_t     threadID[IMEXPAND_MAXTHREAD];
+    long          NBrow;
+    long          NBthread;
+    long          NBstarted;
+
+    plan.in       = (const char *) data.image[ID].array.raw;
+    plan.out      = (char *) data.image[ID_out].array.raw;
+    plan.typesize = ImageStreamIO_typesize(data.image[ID].md[0].datatype);
+    switch(plan.typesize)
+    {
+        case 1:
+            plan.kernel = imexpand_row_uint8_t;
+            break;
+        case 2:
+            plan.kernel = imexpand_row_uint16_t;
+            break;
+        case 4:
+            plan.kernel = imexpand_row_uint32_t;
+            break;
+        case 8:
+            plan.kernel = imexpand_row_uint64_t;
+            break;
+        default:
+            plan.kernel = imexpand_row_IMEXPAND_PIX16;
+    }
+    for(int ax = 0; ax < 3; ax++)
+    {
+        plan.naxes[ax]    = naxes[ax];
+        plan.naxesout[ax] = naxes[ax] * n[ax];
+    }
+    plan.n1 = n[0];
+    plan.n2 = n[1];
+    plan.n3 = n[2];
+
+    NBrow    = naxes[1] * naxes[2];
+    NBthread = sysconf(_SC_NPROCESSORS_ONLN);
+    if(NBthread > NBrow * plan.naxesout[0] * n[1] * n[2] /
+            IMEXPAND_MINTHREADPIX)
+    {
+        NBthread =
+            NBrow * plan.naxesout[0] * n[1] * n[2] / IMEXPAND_MINTHREADPIX;
+    }
+    if(NBthread > NBrow)
+    {
+        NBthread = NBrow;
+    }
+    if(NBthread > IMEXPAND_MAXTHREAD)
+    {
+        NBthread = IMEXPAND_MAXTHREAD;
+    }
+    if(NBthread < 1)
+    {
+        NBthread = 1;
+    }
+
+    for(long t = 0; t < NBthread; t++)
+    {
+        thread[t]          = plan;
+        thread[t].rowstart = NBrow * t / NBthread;
+        thread[t].rowend   = NBrow * (t + 1) / NBthread;
+    }
+    // bands of threads that cannot be started are run by the calling thread
+    for(NBstarted = 1; NBstarted < NBthread; NBstarted++)
+    {
+        if(pthread_create(&threadID[NBstarted],
+                          NULL,
+                          imexpand_thread,
+                          &thread[NBstarted]) != 0)
+        {
+            printf("WARNING: pthread_create error, %ld of %ld threads\n",
+                   NBstarted,
+                   NBthread);
+            break;
+        }
+    }
+    imexpand_thread(&thread[0]);
+    for(long t = NBstarted; t < NBthread; t++)
+    {
+        imexpand_thread(&thread[t]);
+    }
+    for(long t = 1; t < NBstarted; t++)
+    {
+        pthread_join(threadID[t], NULL);
+    }
+}
+
+/* expand image by factor n1 along x axis and n2 along y axis
+ * output has the input datatype
+ */
 imageID
 basic_expand(const char *ID_name, const char *ID_name_out, int n1, int n2)
 {
     DEBUG_TRACE_FSTART();
 
-    imageID ID;
-    imageID ID_out; /* ID for the output image */
-    long    ii, jj;
-    long    naxes[2], naxes_out[2];
-    int     i, j;
+    imageID  ID;
+    imageID  ID_out; /* ID for the output image */
+    long     naxes[3];
+    uint32_t naxes_out[2];
+    int      n[3] = {n1, n2, 1};
 
     ID = image_ID(ID_name);
 
-    naxes[0]     = data.image[ID].md[0].size[0];
-    naxes[1]     = data.image[ID].md[0].size[1];
+    naxes[0] = data.image[ID].md[0].size[0];
+    naxes[1] = 1;
+    naxes[2] = 1;
+    if(data.image[ID].md[0].naxis > 1)
+    {
+        naxes[1] = data.image[ID].md[0].size[1];
+    }
     naxes_out[0] = naxes[0] * n1;
     naxes_out[1] = naxes[1] * n2;
 
-    FUNC_CHECK_RETURN(
-        create_2Dimage_ID(ID_name_out, naxes_out[0], naxes_out[1], &ID_out));
+    FUNC_CHECK_RETURN(create_image_ID(ID_name_out,
+                                      2,
+                                      naxes_out,
+                                      data.image[ID].md[0].datatype,
+                                      0,
+                                      0,
+                                      0,
+                                      &ID_out));
 
-    for(jj = 0; jj < naxes[1]; jj++)
-        for(ii = 0; ii < naxes[0]; ii++)
-            for(i = 0; i < n1; i++)
-                for(j = 0; j < n2; j++)
-                {
-                    data.image[ID_out]
-                    .array.F[(jj * n2 + j) * naxes_out[0] + ii * n1 + i] =
-                        data.image[ID].array.F[jj * naxes[0] + ii];
-                }
+    imexpand_run(ID, ID_out, naxes, n);
 
     DEBUG_TRACE_FEXIT();
     return (ID_out);
 }
 
-/* expand image by factor n1 along x axis and n2 along y axis */
+/* expand image by factor n1 along x axis, n2 along y axis and n3 along z
+ * output has the input datatype
+ */
 imageID basic_expand3D(
     const char *ID_name, const char *ID_name_out, int n1, int n2, int n3)
 {
-    imageID ID;
-    imageID ID_out; /* ID for the output image */
-    long    ii, jj, kk;
-    long    naxes[3], naxes_out[3];
-    int     i, j, k;
+    imageID  ID;
+    imageID  ID_out; /* ID for the output image */
+    long     naxes[3];
+    uint32_t naxes_out[3];
+    int      n[3] = {n1, n2, n3};
 
     ID = image_ID(ID_name);
 
@@ -158,31 +369,20 @@ imageID basic_expand3D(
            naxes[0],
            naxes[1],
            naxes[2],
-           naxes_out[0],
-           naxes_out[1],
-           naxes_out[2]);
-
-    create_3Dimage_ID(ID_name_out,
-                      naxes_out[0],
-                      naxes_out[1],
-                      naxes_out[2],
-                      &ID_out);
-    list_image_ID();
-
-    for(kk = 0; kk < naxes[2]; kk++)
-        for(jj = 0; jj < naxes[1]; jj++)
-            for(ii = 0; ii < naxes[0]; ii++)
-                for(i = 0; i < n1; i++)
-                    for(j = 0; j < n2; j++)
-                        for(k = 0; k < n3; k++)
-                        {
-                            data.image[ID_out]
-                            .array
-                            .F[(kk * n3 + k) * naxes_out[0] * naxes_out[1] +
-                                             (jj * n2 + j) * naxes_out[0] + ii * n1 + i] =
-                                   data.image[ID]
-                                   .array.F[kk * naxes[0] * naxes[1] +
-                                               jj * naxes[0] + ii];
-                        }
+           (long) naxes_out[0],
+           (long) naxes_out[1],
+           (long) naxes_out[2]);
+
+    create_image_ID(ID_name_out,
+                    3,
+                    naxes_out,
+                    data.image[ID].md[0].datatype,
+                    0,
+                    0,
+                    0,
+                    &ID_out);
+
+    imexpand_run(ID, ID_out, naxes, n);
+
     return (ID_out);
 }
@@ -79,7 +79,11 @@ double basic_measure_transl(const char *__restrict ID_name1,
     // STEP 1 : quickly identify regions of image 1 where flux gradient is large
     // select 30% of image pixels
     contractfactor = 2;
-    basic_contract(ID_name1, "_im1C", contractfactor, contractfactor);
+    basic_contract(ID_name1,
+                   "_im1C",
+                   contractfactor,
+                   contractfactor,
+                   IMCONTRACT_MODE_SUM);
     gauss_filter("_im1C", "_im1Cg", 5.0, 10);
     execute_arith("_im1HF=_im1C-_im1Cg");
     execute_arith("_im1HF2=_im1HF*_im1HF");
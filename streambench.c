@@ -0,0 +1,339 @@
+/** @file streambench.c
+ *
+ * Stream latency benchmark : frames written by IMAGE_BASIC_streamfeed are
+ * read back through the stream reader of streamrecord, and the delay from
+ * frame write to consumer wake-up is measured for a sweep of frame sizes
+ * and rates
+ */
+
+#include <pthread.h>
+
+#include "CommandLineInterface/CLIcore.h"
+
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "streambench.h"
+#include "streamfeed.h"
+#include "streamrecord.h"
+#include "streamtiming.h"
+
+// max number of frame sizes and of rates in a sweep
+#define STREAMBENCH_MAXLIST 32
+
+typedef struct
+{
+    char  IDname[STRINGMAXLEN_IMGNAME];
+    char  streamname[STRINGMAXLEN_IMGNAME];
+    float frequ;
+} STREAMBENCH_FEED;
+
+// ==========================================
+// Forward declaration(s)
+// ==========================================
+
+long IMAGE_BASIC_streambench(const char *__restrict sizelist,
+                             const char *__restrict frequlist,
+                             long NBframes,
+                             const char *__restrict outfname);
+
+// ==========================================
+// Command line interface wrapper function(s)
+// ==========================================
+
+static errno_t IMAGE_BASIC_streambench_cli()
+{
+    if(0 + CLI_checkarg(1, 5) + CLI_checkarg(2, 5) + CLI_checkarg(3, 2) +
+            CLI_checkarg(4, 3) ==
+            0)
+    {
+        IMAGE_BASIC_streambench(data.cmdargtoken[1].val.string,
+                                data.cmdargtoken[2].val.string,
+                                data.cmdargtoken[3].val.numl,
+                                data.cmdargtoken[4].val.string);
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+// ==========================================
+// Register CLI command(s)
+// ==========================================
+
+errno_t __attribute__((cold)) streambench_addCLIcmd()
+{
+
+    RegisterCLIcommand(
+        "imgstreambench",
+        __FILE__,
+        IMAGE_BASIC_streambench_cli,
+        "measure stream write-to-wakeup latency and throughput",
+        "<frame sizes (comma list, pixels)> <rates (comma list, Hz)> "
+        "<# frames per test> <output file>",
+        "imgstreambench 64,256,1024 1000,10000 10000 streambench.txt",
+        "long IMAGE_BASIC_streambench(const char *sizelist, const char "
+        "*frequlist, long NBframes, const char *outfname)");
+
+    return RETURN_SUCCESS;
+}
+
+// parse comma-separated list of numbers, returns number of values
+static int streambench_parselist(const char *list, double *val)
+{
+    char  listcp[STRINGMAXLEN_FILENAME];
+    char *saveptr;
+    char *tok;
+    int   NBval = 0;
+
+    strncpy(listcp, list, STRINGMAXLEN_FILENAME - 1);
+    listcp[STRINGMAXLEN_FILENAME - 1] = '\0';
+    tok                               = strtok_r(listcp, ",", &saveptr);
+    while((tok != NULL) && (NBval < STREAMBENCH_MAXLIST))
+    {
+        val[NBval] = atof(tok);
+        NBval++;
+        tok = strtok_r(NULL, ",", &saveptr);
+    }
+
+    return NBval;
+}
+
+static void *streambench_feed_thread(void *ptr)
+{
+    STREAMBENCH_FEED *feed = (STREAMBENCH_FEED *) ptr;
+
+    IMAGE_BASIC_streamfeed(feed->IDname, feed->streamname, feed->frequ);
+
+    return NULL;
+}
+
+// run one test : NBframes frames of size x size floats at frequ Hz
+// writes one result line to fp
+static errno_t
+streambench_run(uint32_t size, float frequ, long NBframes, FILE *fp)
+{
+    STREAMBENCH_FEED         feed;
+    pthread_t                feedthread;
+    uint32_t                 naxes[2];
+    imageID                  ID;
+    imageID                  IDs;
+    IMAGE_BASIC_STREAMREADER reader;
+    IMAGE_BASIC_JITTERHIST   lathist;
+    struct timespec          twrite;
+    struct timespec          twake;
+    struct timespec          tfirst;
+    struct timespec          tlast;
+    uint64_t                 cnt0start;
+    long                     NBrecv;
+    long                     NBlatdrop;
+    double                   dt;
+    double                   fps;
+    double                   GBps;
+    char                    *frame;
+
+    WRITE_IMAGENAME(feed.IDname, "_streambench_in");
+    WRITE_IMAGENAME(feed.streamname, "_streambench");
+    feed.frequ = frequ;
+
+    naxes[0] = size;
+    naxes[1] = size;
+    create_image_ID(feed.IDname, 2, naxes, _DATATYPE_FLOAT, 0, 0, 0, &ID);
+    for(uint64_t ii = 0; ii < (uint64_t) size * size; ii++)
+    {
+        data.image[ID].array.F[ii] = 1.0;
+    }
+    create_image_ID(feed.streamname, 2, naxes, _DATATYPE_FLOAT, 1, 0, 0, &IDs);
+
+    frame = (char *) malloc(sizeof(float) * size * size);
+    if(frame == NULL)
+    {
+        PRINT_ERROR("malloc error");
+        abort();
+    }
+
+    image_basic_jitterhist_init(&lathist);
+    image_basic_streamreader_init(&reader, IDs);
+    cnt0start = reader.cnt0;
+
+    IMAGE_BASIC_streamfeed_setNBframe(NBframes);
+    pthread_create(&feedthread, NULL, streambench_feed_thread, &feed);
+
+    NBrecv    = 0;
+    NBlatdrop = 0;
+    clock_gettime(CLOCK_MONOTONIC, &tfirst);
+    tlast = tfirst;
+    while(image_basic_streamreader_wait(&reader, 1000000) == 1)
+    {
+        if(reader.cnt0 - cnt0start > (uint64_t) NBframes)
+        {
+            // zero frame written by streamfeed on exit
+            break;
+        }
+        // writetime is only valid for this frame if the feed has not
+        // started the next one : otherwise the sample is dropped, it would
+        // under-report latency
+        twrite = data.image[IDs].md[0].writetime;
+        clock_gettime(CLOCK_REALTIME, &twake);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if((data.image[IDs].md[0].write == 0) &&
+                (data.image[IDs].md[0].cnt0 == reader.cnt0))
+        {
+            image_basic_jitterhist_add(
+                &lathist,
+                image_basic_timespec_diff_ns(&twrite, &twake));
+        }
+        else
+        {
+            NBlatdrop++;
+        }
+        image_basic_streamreader_copy(&reader, frame);
+
+        clock_gettime(CLOCK_MONOTONIC, &tlast);
+        if(NBrecv == 0)
+        {
+            tfirst = tlast;
+        }
+        NBrecv++;
+        if(reader.cnt0 - cnt0start == (uint64_t) NBframes)
+        {
+            break;
+        }
+    }
+    pthread_join(feedthread, NULL);
+    if(NBlatdrop > 0)
+    {
+        printf("%ld latency sample(s) dropped, next frame already written\n",
+               NBlatdrop);
+    }
+
+    dt   = 1.0e-9 * image_basic_timespec_diff_ns(&tfirst, &tlast);
+    fps  = 0.0;
+    GBps = 0.0;
+    if((NBrecv > 1) && (dt > 0.0))
+    {
+        fps  = (NBrecv - 1) / dt;
+        GBps = fps * sizeof(float) * size * size * 1.0e-9;
+    }
+
+    fprintf(fp,
+            "%6u %10zu %10.1f %8ld %8ld %8ld %8ld %12.1f %9.4f %9.3f %5ld "
+            "%5ld %5ld %5ld %9.3f\n",
+            size,
+            sizeof(float) * size * size,
+            frequ,
+            NBframes,
+            NBrecv,
+            reader.NBmissed,
+            reader.NBtorn,
+            fps,
+            GBps,
+            (lathist.NBsample > 0) ?
+            1.0e-3 * lathist.sum_ns / lathist.NBsample : 0.0,
+            image_basic_jitterhist_percentile_us(&lathist, 0.5),
+            image_basic_jitterhist_percentile_us(&lathist, 0.9),
+            image_basic_jitterhist_percentile_us(&lathist, 0.99),
+            image_basic_jitterhist_percentile_us(&lathist, 0.999),
+            (lathist.NBsample > 0) ? 1.0e-3 * lathist.max_ns : 0.0);
+    fflush(fp);
+
+    free(frame);
+    delete_image_ID(feed.streamname, DELETE_IMAGE_ERRMODE_WARNING);
+    delete_image_ID(feed.IDname, DELETE_IMAGE_ERRMODE_WARNING);
+
+    return RETURN_SUCCESS;
+}
+
+// stream latency benchmark
+//
+// For each frame size (square, float) and each rate of the lists, feeds
+// NBframes frames into a shared memory stream with IMAGE_BASIC_streamfeed
+// and reads them back with the streamrecord stream reader. Latency is the
+// time from frame writetime (stamped by the feed after the copy) to
+// consumer wake-up. Current imgstreamfeedtiming settings apply.
+//
+// Results are appended to outfname, one line per test, columns :
+//   size  framesize[B]  frequ[Hz]  NBsent  NBrecv  NBmissed  NBtorn
+//   frames/s  GB/s  lat_ave[us]  lat_p50  lat_p90  lat_p99  lat_p99.9
+//   lat_max[us]
+// percentiles are upper edges of 1 us bins
+long IMAGE_BASIC_streambench(const char *__restrict sizelist,
+                             const char *__restrict frequlist,
+                             long NBframes,
+                             const char *__restrict outfname)
+{
+    double                          sizeval[STREAMBENCH_MAXLIST];
+    double                          frequval[STREAMBENCH_MAXLIST];
+    int                             NBsize;
+    int                             NBfrequ;
+    FILE                           *fp;
+    IMAGE_BASIC_STREAMFEED_SETTINGS feedsettings;
+
+    NBsize  = streambench_parselist(sizelist, sizeval);
+    NBfrequ = streambench_parselist(frequlist, frequval);
+    if((NBsize == 0) || (NBfrequ == 0) || (NBframes < 1))
+    {
+        PRINT_ERROR("empty frame size or rate list");
+        return RETURN_FAILURE;
+    }
+
+    fp = fopen(outfname, "a");
+    if(fp == NULL)
+    {
+        PRINT_ERROR("cannot open file %s", outfname);
+        return RETURN_FAILURE;
+    }
+    fprintf(fp,
+            "# %4s %10s %10s %8s %8s %8s %8s %12s %9s %9s %5s %5s %5s %5s "
+            "%9s\n",
+            "size",
+            "bytes",
+            "frequ",
+            "sent",
+            "recv",
+            "missed",
+            "torn",
+            "frames/s",
+            "GB/s",
+            "lat_ave",
+            "p50",
+            "p90",
+            "p99",
+            "p999",
+            "lat_max");
+
+    // plain single-slice feed, user settings are restored at the end
+    image_basic_streamfeed_savesettings(&feedsettings);
+    IMAGE_BASIC_streamfeed_setcbuff(0);
+    IMAGE_BASIC_streamfeed_settimestamps("none");
+
+    for(int is = 0; is < NBsize; is++)
+    {
+        for(int ifr = 0; ifr < NBfrequ; ifr++)
+        {
+            printf("\n==== size %4ld  rate %10.1f Hz ====\n",
+                   (long) sizeval[is],
+                   frequval[ifr]);
+            streambench_run((uint32_t) sizeval[is],
+                            (float) frequval[ifr],
+                            NBframes,
+                            fp);
+            if((data.signal_INT == 1) || (data.signal_TERM == 1))
+            {
+                break;
+            }
+        }
+        if((data.signal_INT == 1) || (data.signal_TERM == 1))
+        {
+            break;
+        }
+    }
+
+    image_basic_streamfeed_restoresettings(&feedsettings);
+    fclose(fp);
+
+    printf("results written to %s\n", outfname);
+
+    return RETURN_SUCCESS;
+}
@@ -0,0 +1,9 @@
+/** @file streambench.h
+ */
+
+errno_t __attribute__((cold)) streambench_addCLIcmd();
+
+long IMAGE_BASIC_streambench(const char *__restrict sizelist,
+                             const char *__restrict frequlist,
+                             long NBframes,
+                             const char *__restrict outfname);
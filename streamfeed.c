@@ -1,12 +1,50 @@
 /** @file streamfeed.c
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // CPU affinity macros
+#endif
+
+#include <fcntl.h>
 #include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #include "CommandLineInterface/CLIcore.h"
 
 #include "COREMOD_memory/COREMOD_memory.h"
 
+#include "streamfeed.h"
+#include "streamfits.h"
+#include "streamtiming.h"
+
+// file-backed source : size of chunks prefetched ahead of feed [bytes]
+#define STREAMFEED_CHUNKSIZE (16L * 1024 * 1024)
+
+// max number of output streams fed from one loop
+#define STREAMFEED_MAXOUT 32
+
+// frame pacing settings, see IMAGE_BASIC_streamfeed_settiming()
+static long streamfeed_spinus                           = 0;
+static char streamfeed_jittername[STRINGMAXLEN_IMGNAME] = "";
+
+// circular buffer mode, see IMAGE_BASIC_streamfeed_setcbuff()
+static int streamfeed_cbuffmode = 0;
+
+// timestamp replay table, see IMAGE_BASIC_streamfeed_settimestamps()
+static char streamfeed_tstampname[STRINGMAXLEN_IMGNAME] = "";
+
+// number of frames fed, see IMAGE_BASIC_streamfeed_setNBframe()
+static long streamfeed_NBframemax = 0;
+
+// real-time placement, see IMAGE_BASIC_streamfeed_setRT()
+static char streamfeed_cpuset[STRINGMAXLEN_IMGNAME] = "";
+static int  streamfeed_policy                       = SCHED_FIFO;
+static int  streamfeed_priority                     = 95;
+static int  streamfeed_mlock                        = 0;
+static int  streamfeed_prefault                     = 0;
+
 // ==========================================
 // Forward declaration(s)
 // ==========================================
@@ -14,13 +52,34 @@ long IMAGE_BASIC_streamfeed(const char *__restrict IDname,
                             const char *__restrict streamname,
                             float frequ);
 
+long IMAGE_BASIC_streamfeed_file(const char *__restrict fname,
+                                 const char *__restrict streamname,
+                                 float frequ);
+
+errno_t IMAGE_BASIC_streamfeed_settiming(long spinus,
+        const char *__restrict IDjitter_name);
+
+errno_t IMAGE_BASIC_streamfeed_setcbuff(int cbuffmode);
+
+errno_t IMAGE_BASIC_streamfeed_settimestamps(
+    const char *__restrict IDtiming_name);
+
+errno_t IMAGE_BASIC_streamfeed_setNBframe(long NBframemax);
+
+errno_t IMAGE_BASIC_streamfeed_setRT(const char *__restrict cpuset,
+                                     const char *__restrict policy,
+                                     int priority,
+                                     int memlock,
+                                     int prefault);
+
 // ==========================================
 // Command line interface wrapper function(s)
 // ==========================================
 
 static errno_t image_basic_streamfeed_cli()
 {
-    if(CLI_checkarg(1, 4) + CLI_checkarg(2, 4) + CLI_checkarg(3, 1) == 0)
+    // stream argument may be a list of streams
+    if(CLI_checkarg(1, 4) + CLI_checkarg(2, 5) + CLI_checkarg(3, 1) == 0)
     {
         IMAGE_BASIC_streamfeed(data.cmdargtoken[1].val.string,
                                data.cmdargtoken[2].val.string,
@@ -33,6 +92,93 @@ static errno_t image_basic_streamfeed_cli()
     }
 }
 
+static errno_t image_basic_streamfeed_file_cli()
+{
+    if(CLI_checkarg(1, 3) + CLI_checkarg(2, 5) + CLI_checkarg(3, 1) == 0)
+    {
+        IMAGE_BASIC_streamfeed_file(data.cmdargtoken[1].val.string,
+                                    data.cmdargtoken[2].val.string,
+                                    data.cmdargtoken[3].val.numf);
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+static errno_t image_basic_streamfeed_settiming_cli()
+{
+    if(CLI_checkarg(1, 2) + CLI_checkarg(2, 5) == 0)
+    {
+        IMAGE_BASIC_streamfeed_settiming(data.cmdargtoken[1].val.numl,
+                                         data.cmdargtoken[2].val.string);
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+static errno_t image_basic_streamfeed_setcbuff_cli()
+{
+    if(CLI_checkarg(1, 2) == 0)
+    {
+        IMAGE_BASIC_streamfeed_setcbuff(data.cmdargtoken[1].val.numl);
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+static errno_t image_basic_streamfeed_settimestamps_cli()
+{
+    if(CLI_checkarg(1, 5) == 0)
+    {
+        IMAGE_BASIC_streamfeed_settimestamps(data.cmdargtoken[1].val.string);
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+static errno_t image_basic_streamfeed_setNBframe_cli()
+{
+    if(CLI_checkarg(1, 2) == 0)
+    {
+        IMAGE_BASIC_streamfeed_setNBframe(data.cmdargtoken[1].val.numl);
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+static errno_t image_basic_streamfeed_setRT_cli()
+{
+    if(CLI_checkarg(1, 5) + CLI_checkarg(2, 5) + CLI_checkarg(3, 2) +
+            CLI_checkarg(4, 2) + CLI_checkarg(5, 2) ==
+            0)
+    {
+        IMAGE_BASIC_streamfeed_setRT(data.cmdargtoken[1].val.string,
+                                     data.cmdargtoken[2].val.string,
+                                     data.cmdargtoken[3].val.numl,
+                                     data.cmdargtoken[4].val.numl,
+                                     data.cmdargtoken[5].val.numl);
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
 // ==========================================
 // Register CLI command(s)
 // ==========================================
@@ -43,66 +189,679 @@ errno_t __attribute__((cold)) streamfeed_addCLIcmd()
                        __FILE__,
                        image_basic_streamfeed_cli,
                        "feed stream of images",
-                       "<input image/cube> <stream> <fequ [Hz]>",
+                       "<input image/cube> <stream[:offset],...> <fequ [Hz]>",
                        "imgstreamfeed im imstream 100",
                        "long IMAGE_BASIC_streamfeed(const char *IDname, const "
                        "char *streamname, float frequ)");
 
+    RegisterCLIcommand("imgstreamfeedfile",
+                       __FILE__,
+                       image_basic_streamfeed_file_cli,
+                       "feed stream of images from FITS or raw cube file",
+                       "<input file> <stream[:offset],...> <fequ [Hz]>",
+                       "imgstreamfeedfile seq.fits imstream 1000",
+                       "long IMAGE_BASIC_streamfeed_file(const char *fname, "
+                       "const char *streamname, float frequ)");
+
+    RegisterCLIcommand(
+        "imgstreamfeedtiming",
+        __FILE__,
+        image_basic_streamfeed_settiming_cli,
+        "set imgstreamfeed frame pacing",
+        "<busy-spin tail [us]> <jitter histogram image, none to skip>",
+        "imgstreamfeedtiming 50 feedjitter",
+        "errno_t IMAGE_BASIC_streamfeed_settiming(long spinus, const char "
+        "*IDjitter_name)");
+
+    RegisterCLIcommand(
+        "imgstreamfeedcbuff",
+        __FILE__,
+        image_basic_streamfeed_setcbuff_cli,
+        "set imgstreamfeed circular buffer mode",
+        "<mode (0: write slice 0, 1: advance cnt1 over output slices)>",
+        "imgstreamfeedcbuff 1",
+        "errno_t IMAGE_BASIC_streamfeed_setcbuff(int cbuffmode)");
+
+    RegisterCLIcommand(
+        "imgstreamfeedtstamp",
+        __FILE__,
+        image_basic_streamfeed_settimestamps_cli,
+        "replay recorded frame timestamps in imgstreamfeed",
+        "<timing table image (imgstreamrec _timing), none for fixed rate>",
+        "imgstreamfeedtstamp seq_timing",
+        "errno_t IMAGE_BASIC_streamfeed_settimestamps(const char "
+        "*IDtiming_name)");
+
+    RegisterCLIcommand("imgstreamfeedNBframe",
+                       __FILE__,
+                       image_basic_streamfeed_setNBframe_cli,
+                       "set number of frames fed by imgstreamfeed",
+                       "<# frames (0: until interrupted)>",
+                       "imgstreamfeedNBframe 10000",
+                       "errno_t IMAGE_BASIC_streamfeed_setNBframe(long "
+                       "NBframemax)");
+
+    RegisterCLIcommand(
+        "imgstreamfeedRT",
+        __FILE__,
+        image_basic_streamfeed_setRT_cli,
+        "set imgstreamfeed CPU affinity, scheduling and memory locking",
+        "<CPUs (e.g. 3 or 2,4-5, none)> <policy (fifo, rr, other)> "
+        "<priority> <mlockall (0/1)> <prefault source (0/1)>",
+        "imgstreamfeedRT 3 fifo 95 1 1",
+        "errno_t IMAGE_BASIC_streamfeed_setRT(const char *cpuset, const char "
+        "*policy, int priority, int memlock, int prefault)");
+
     return RETURN_SUCCESS;
 }
 
-// feed image to data stream
-// only works on slice #1 out output
-long IMAGE_BASIC_streamfeed(const char *__restrict IDname,
-                            const char *__restrict streamname,
-                            float frequ)
+/* set frame pacing used by next IMAGE_BASIC_streamfeed call
+ *
+ * spinus        : the last spinus microsecond before each frame deadline
+ *                 are spent busy-waiting instead of sleeping
+ * IDjitter_name : if not "none", wake-up jitter histogram is written to this
+ *                 image (1 us bins) when the feed loop exits
+ */
+errno_t IMAGE_BASIC_streamfeed_settiming(long spinus,
+        const char *__restrict IDjitter_name)
+{
+    if(spinus < 0)
+    {
+        spinus = 0;
+    }
+
+    if(strcmp(IDjitter_name, "none") == 0)
+    {
+        streamfeed_jittername[0] = '\0';
+    }
+    else if(strlen(IDjitter_name) >= STRINGMAXLEN_IMGNAME)
+    {
+        PRINT_ERROR("jitter image name too long");
+        return RETURN_FAILURE;
+    }
+    else
+    {
+        snprintf(streamfeed_jittername,
+                 STRINGMAXLEN_IMGNAME,
+                 "%s",
+                 IDjitter_name);
+    }
+    streamfeed_spinus = spinus;
+
+    printf("streamfeed busy-spin tail = %ld us\n", streamfeed_spinus);
+
+    return RETURN_SUCCESS;
+}
+
+/* set output mode used by next IMAGE_BASIC_streamfeed call
+ *
+ * cbuffmode = 0 : each frame is written to slice 0 of the output stream
+ * cbuffmode = 1 : output stream is a 3D circular buffer, each frame is
+ *                 written to slice cnt1+1 (modulo number of slices) and
+ *                 cnt1 is advanced, so the last size[2] frames stay
+ *                 available to consumers
+ */
+errno_t IMAGE_BASIC_streamfeed_setcbuff(int cbuffmode)
+{
+    streamfeed_cbuffmode = cbuffmode;
+
+    printf("streamfeed circular buffer mode = %d\n", streamfeed_cbuffmode);
+
+    return RETURN_SUCCESS;
+}
+
+/* set timestamps replayed by next IMAGE_BASIC_streamfeed call
+ *
+ * IDtiming_name : "none" to feed at fixed frequency, or double image
+ *                 holding one timestamp [s] per input frame. With a 2D
+ *                 table (as the <name>_timing table written by
+ *                 imgstreamrec) column 1 is used, with a 1D image each
+ *                 pixel is a timestamp.
+ *
+ * Frame k is then written at t0 + (ts[k] - ts[0]), reproducing the
+ * recorded inter-frame intervals including bursts and stalls. frequ is
+ * only used as the interval between last and first frame when the
+ * sequence loops.
+ */
+errno_t IMAGE_BASIC_streamfeed_settimestamps(
+    const char *__restrict IDtiming_name)
+{
+    if(strcmp(IDtiming_name, "none") == 0)
+    {
+        streamfeed_tstampname[0] = '\0';
+        printf("streamfeed fixed frame rate\n");
+    }
+    else if(strlen(IDtiming_name) >= STRINGMAXLEN_IMGNAME)
+    {
+        PRINT_ERROR("timestamp image name too long");
+        return RETURN_FAILURE;
+    }
+    else
+    {
+        snprintf(streamfeed_tstampname,
+                 STRINGMAXLEN_IMGNAME,
+                 "%s",
+                 IDtiming_name);
+        printf("streamfeed replaying timestamps from %s\n",
+               streamfeed_tstampname);
+    }
+
+    return RETURN_SUCCESS;
+}
+
+/* set number of frames written by next IMAGE_BASIC_streamfeed call
+ * NBframemax = 0 : feed until interrupted
+ */
+errno_t IMAGE_BASIC_streamfeed_setNBframe(long NBframemax)
+{
+    if(NBframemax < 0)
+    {
+        NBframemax = 0;
+    }
+    streamfeed_NBframemax = NBframemax;
+
+    return RETURN_SUCCESS;
+}
+
+/* save / restore the per-call feed settings (circular buffer mode,
+ * timestamp table, number of frames), so that functions driving the feed
+ * with their own settings, as imgstreambench, leave the user settings
+ * unchanged
+ */
+void image_basic_streamfeed_savesettings(
+    IMAGE_BASIC_STREAMFEED_SETTINGS *settings)
+{
+    settings->cbuffmode  = streamfeed_cbuffmode;
+    settings->NBframemax = streamfeed_NBframemax;
+    memcpy(settings->tstampname,
+           streamfeed_tstampname,
+           sizeof(streamfeed_tstampname));
+}
+
+void image_basic_streamfeed_restoresettings(
+    const IMAGE_BASIC_STREAMFEED_SETTINGS *settings)
+{
+    streamfeed_cbuffmode  = settings->cbuffmode;
+    streamfeed_NBframemax = settings->NBframemax;
+    memcpy(streamfeed_tstampname,
+           settings->tstampname,
+           sizeof(streamfeed_tstampname));
+}
+
+/* set real-time placement of the feed loop for next IMAGE_BASIC_streamfeed
+ *
+ * cpuset   : CPUs the feed thread is pinned to, list of CPU numbers and
+ *            ranges (e.g. "3" or "2,4-5"), "none" to leave affinity as is
+ * policy   : scheduler policy, "fifo" (default), "rr" or "other"
+ * priority : real-time priority 1-99 (default 95), ignored for "other"
+ * memlock  : 1 to lock current and future pages of the process (mlockall)
+ * prefault : 1 to touch every page of source and output stream before
+ *            the first frame, so the first pass through a large cube does
+ *            not take page faults
+ *
+ * Settings actually in effect are reported when the feed starts.
+ */
+errno_t IMAGE_BASIC_streamfeed_setRT(const char *__restrict cpuset,
+                                     const char *__restrict policy,
+                                     int priority,
+                                     int memlock,
+                                     int prefault)
+{
+    if(strcmp(cpuset, "none") == 0)
+    {
+        streamfeed_cpuset[0] = '\0';
+    }
+    else
+    {
+        strncpy(streamfeed_cpuset, cpuset, STRINGMAXLEN_IMGNAME - 1);
+    }
+
+    if(strcmp(policy, "fifo") == 0)
+    {
+        streamfeed_policy = SCHED_FIFO;
+    }
+    else if(strcmp(policy, "rr") == 0)
+    {
+        streamfeed_policy = SCHED_RR;
+    }
+    else if(strcmp(policy, "other") == 0)
+    {
+        streamfeed_policy = SCHED_OTHER;
+    }
+    else
+    {
+        PRINT_ERROR("unknown scheduler policy %s", policy);
+        return RETURN_FAILURE;
+    }
+
+    streamfeed_priority = priority;
+    streamfeed_mlock    = memlock;
+    streamfeed_prefault = prefault;
+
+    return RETURN_SUCCESS;
+}
+
+/* frame deadline offsets [ns] from timestamp table, relative to frame 0
+ * NBframe + 1 values, the last one is the loop duration
+ * returns NULL if table cannot be used
+ */
+static int64_t *streamfeed_loadtimestamps(long NBframe, double period_ns)
+{
+    imageID  IDt;
+    long     NBrow;
+    long     NBcol;
+    long     col;
+    int64_t *toffset_ns;
+    double   ts0;
+    double   ts;
+
+    IDt = image_ID(streamfeed_tstampname);
+    if(IDt == -1)
+    {
+        printf("ERROR: timestamp table %s not found\n", streamfeed_tstampname);
+        return NULL;
+    }
+
+    if(data.image[IDt].md[0].naxis == 1)
+    {
+        NBcol = 1;
+        NBrow = data.image[IDt].md[0].size[0];
+        col   = 0;
+    }
+    else
+    {
+        NBcol = data.image[IDt].md[0].size[0];
+        NBrow = data.image[IDt].md[0].size[1];
+        col   = (NBcol > 1) ? 1 : 0;
+    }
+    if(NBrow < NBframe)
+    {
+        printf("ERROR: %ld timestamps for %ld frames\n", NBrow, NBframe);
+        return NULL;
+    }
+    // float epoch seconds have ~128 s resolution, inter-frame timing is lost
+    if(data.image[IDt].md[0].datatype != _DATATYPE_DOUBLE)
+    {
+        printf("ERROR: timestamp table must be double\n");
+        return NULL;
+    }
+
+    toffset_ns = (int64_t *) malloc(sizeof(int64_t) * (NBframe + 1));
+    if(toffset_ns == NULL)
+    {
+        PRINT_ERROR("malloc error");
+        abort();
+    }
+
+    ts0 = 0.0;
+    for(long k = 0; k < NBframe; k++)
+    {
+        ts = data.image[IDt].array.D[k * NBcol + col];
+        if(k == 0)
+        {
+            ts0 = ts;
+        }
+        toffset_ns[k] = (int64_t)((ts - ts0) * 1.0e9 + 0.5);
+
+        // out of order timestamps are fed immediately
+        if((k > 0) && (toffset_ns[k] < toffset_ns[k - 1]))
+        {
+            toffset_ns[k] = toffset_ns[k - 1];
+        }
+    }
+    toffset_ns[NBframe] = toffset_ns[NBframe - 1] + (int64_t)(period_ns + 0.5);
+
+    printf("replaying %ld timestamps, sequence duration %.6f s\n",
+           NBframe,
+           1.0e-9 * toffset_ns[NBframe]);
+
+    return toffset_ns;
+}
+
+// frame source of the feed loop
+typedef struct
+{
+    const char *ptr;       // first frame
+    size_t      framesize; // bytes
+    uint64_t    nelement;  // values per frame
+    uint8_t     datatype;
+    long        NBframe;
+    int         fitsdata;  // frames are FITS (big endian) data
+    int         mmapped;   // file-backed : prefetch ahead of feed pointer
+    long        NBframechunk;
+} STREAMFEED_SOURCE;
+
+// output streams of the feed loop
+typedef struct
+{
+    int     NBout;
+    imageID ID[STREAMFEED_MAXOUT];
+    long    offset[STREAMFEED_MAXOUT];  // source frame offset
+    long    NBslice[STREAMFEED_MAXOUT]; // circular buffer slices
+    long    slice[STREAMFEED_MAXOUT];   // last written slice
+} STREAMFEED_OUTPUT;
+
+/* parse output stream list "stream1[:offset1],stream2[:offset2],..."
+ * stream i is fed source frame k + offset i
+ * returns number of streams, -1 on error
+ */
+static int streamfeed_parseoutput(const char *streamnames,
+                                  STREAMFEED_OUTPUT *out)
+{
+    char  list[STRINGMAXLEN_FILENAME];
+    char *saveptr;
+    char *tok;
+    char *sep;
+
+    strncpy(list, streamnames, STRINGMAXLEN_FILENAME - 1);
+    list[STRINGMAXLEN_FILENAME - 1] = '\0';
+
+    out->NBout = 0;
+    tok        = strtok_r(list, ",", &saveptr);
+    while(tok != NULL)
+    {
+        if(out->NBout == STREAMFEED_MAXOUT)
+        {
+            printf("ERROR: more than %d output streams\n", STREAMFEED_MAXOUT);
+            return -1;
+        }
+        out->offset[out->NBout] = 0;
+        sep                     = strchr(tok, ':');
+        if(sep != NULL)
+        {
+            *sep                    = '\0';
+            out->offset[out->NBout] = atol(sep + 1);
+        }
+        out->ID[out->NBout] = image_ID(tok);
+        if(out->ID[out->NBout] == -1)
+        {
+            printf("ERROR: stream %s not found\n", tok);
+            return -1;
+        }
+        out->NBout++;
+        tok = strtok_r(NULL, ",", &saveptr);
+    }
+
+    return out->NBout;
+}
+
+// all output streams must match source frame size and datatype
+static void streamfeed_checkoutput(const STREAMFEED_OUTPUT *out,
+                                   long                     xsize,
+                                   long                     ysize,
+                                   uint8_t                  datatype)
+{
+    for(int o = 0; o < out->NBout; o++)
+    {
+        imageID IDs = out->ID[o];
+
+        if((xsize != data.image[IDs].md[0].size[0]) ||
+                (ysize != data.image[IDs].md[0].size[1]))
+        {
+            printf("ERROR: images have different x and y sizes");
+            exit(0);
+        }
+        if(datatype != data.image[IDs].md[0].datatype)
+        {
+            printf("ERROR: images have different data types");
+            exit(0);
+        }
+    }
+}
+
+// madvise frames [k, k+NBframe) of file-backed source, wrapping at end
+static void streamfeed_advise(const STREAMFEED_SOURCE *src,
+                              long                     k,
+                              long                     NBframe,
+                              int                      advice)
+{
+    long   pagesize = sysconf(_SC_PAGESIZE);
+    size_t offset;
+    size_t size;
+
+    k = k % src->NBframe;
+    if(k + NBframe > src->NBframe)
+    {
+        streamfeed_advise(src, 0, k + NBframe - src->NBframe, advice);
+        NBframe = src->NBframe - k;
+    }
+
+    offset = (size_t)((uintptr_t)(src->ptr + k * src->framesize) % pagesize);
+    size   = NBframe * src->framesize;
+    if(advice == MADV_DONTNEED)
+    {
+        // only release pages entirely inside the frames
+        offset = (pagesize - offset) % pagesize;
+        if(size <= offset)
+        {
+            return;
+        }
+        size = (size - offset) / pagesize * pagesize;
+        madvise((char *) src->ptr + k * src->framesize + offset, size, advice);
+    }
+    else
+    {
+        madvise((char *) src->ptr + k * src->framesize - offset,
+                size + offset,
+                advice);
+    }
+}
+
+// touch one byte per page of size bytes at ptr
+// returns number of pages
+static long streamfeed_prefault_pages(volatile char *ptr, size_t size, int rw)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    long NBpage   = 0;
+
+    for(size_t offset = 0; offset < size; offset += pagesize)
+    {
+        if(rw == 1)
+        {
+            ptr[offset] = ptr[offset];
+        }
+        else
+        {
+            (void) ptr[offset];
+        }
+        NBpage++;
+    }
+
+    return NBpage;
+}
+
+// apply real-time settings to calling thread and report those in effect
+static void streamfeed_applyRT(const STREAMFEED_SOURCE *src,
+                               const STREAMFEED_OUTPUT *out)
 {
-    imageID            ID;
-    imageID            IDs;
-    long               xsize, ysize, xysize, zsize;
-    long               k;
-    long               tdelay;
-    int                RT_priority = 95; //any number from 0-99
     struct sched_param schedpar;
-    int                semval;
-    const char        *ptr0;
-    const char        *ptr1;
-    int                loopOK;
-    long               ii;
+    cpu_set_t          cpumask;
+    char              *saveptr;
+    char              *tok;
+    char               cpulist[STRINGMAXLEN_IMGNAME];
+    int                memlocked = 0;
+    long               NBpage    = 0;
+    int                policy;
+
+    if(streamfeed_cpuset[0] != '\0')
+    {
+        CPU_ZERO(&cpumask);
+        strcpy(cpulist, streamfeed_cpuset);
+        tok = strtok_r(cpulist, ",", &saveptr);
+        while(tok != NULL)
+        {
+            int cpu0 = atoi(tok);
+            int cpu1 = cpu0;
+
+            if(strchr(tok, '-') != NULL)
+            {
+                cpu1 = atoi(strchr(tok, '-') + 1);
+            }
+            for(int cpu = cpu0; cpu <= cpu1; cpu++)
+            {
+                CPU_SET(cpu, &cpumask);
+            }
+            tok = strtok_r(NULL, ",", &saveptr);
+        }
+        if(sched_setaffinity(0, sizeof(cpu_set_t), &cpumask) != 0)
+        {
+            perror("sched_setaffinity");
+        }
+    }
 
-    schedpar.sched_priority = RT_priority;
+    schedpar.sched_priority =
+        (streamfeed_policy == SCHED_OTHER) ? 0 : streamfeed_priority;
     if(seteuid(data.euid) != 0)  //This goes up to maximum privileges
     {
         PRINT_ERROR("seteuid error");
     }
-    sched_setscheduler(0,
-                       SCHED_FIFO,
-                       &schedpar); //other option is SCHED_RR, might be faster
+    if(sched_setscheduler(0, streamfeed_policy, &schedpar) != 0)
+    {
+        perror("sched_setscheduler");
+    }
+    if(streamfeed_mlock == 1)
+    {
+        if(src->mmapped == 1)
+        {
+            // would lock the whole file mapping
+            printf("mlockall skipped : file-backed source\n");
+        }
+        else if(mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+        {
+            memlocked = 1;
+        }
+        else
+        {
+            perror("mlockall");
+        }
+    }
     if(seteuid(data.ruid) != 0)    //Go back to normal privileges
     {
         PRINT_ERROR("seteuid error");
     }
 
-    ID     = image_ID(IDname);
-    xsize  = data.image[ID].md[0].size[0];
-    ysize  = data.image[ID].md[0].size[1];
-    xysize = xsize * ysize;
+    if(streamfeed_prefault == 1)
+    {
+        size_t NBframe = src->NBframe;
+
+        if(src->mmapped == 1)
+        {
+            // file-backed sources are prefetched chunk by chunk
+            NBframe = (src->NBframechunk < src->NBframe) ?
+                      src->NBframechunk : src->NBframe;
+        }
+        NBpage = streamfeed_prefault_pages((volatile char *) src->ptr,
+                                           NBframe * src->framesize,
+                                           0);
+        for(int o = 0; o < out->NBout; o++)
+        {
+            imageID IDs = out->ID[o];
 
-    tdelay = (long)(1000000.0 / frequ);
+            NBpage += streamfeed_prefault_pages(
+                          (volatile char *) data.image[IDs].array.raw,
+                          (size_t) ImageStreamIO_typesize(
+                              data.image[IDs].md[0].datatype) *
+                          data.image[IDs].md[0].nelement,
+                          1);
+        }
+    }
+
+    // report what is actually in effect
+    sched_getaffinity(0, sizeof(cpu_set_t), &cpumask);
+    printf("feed thread CPUs     :");
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if(CPU_ISSET(cpu, &cpumask))
+        {
+            printf(" %d", cpu);
+        }
+    }
+    printf("\n");
+    policy = sched_getscheduler(0);
+    sched_getparam(0, &schedpar);
+    printf("scheduler            : %s, priority %d\n",
+           (policy == SCHED_FIFO) ? "SCHED_FIFO" :
+           (policy == SCHED_RR) ? "SCHED_RR" : "SCHED_OTHER",
+           schedpar.sched_priority);
+    printf("memory locked        : %s\n", memlocked ? "yes" : "no");
+    printf("pages prefaulted     : %ld\n", NBpage);
+}
+
+// feed frames from src to output streams until signal received
+//
+// all outputs are written under the same clock tick, semaphores are
+// posted once every output holds its new frame
+static long
+streamfeed_loop(STREAMFEED_SOURCE *src, STREAMFEED_OUTPUT *out, float frequ)
+{
+    long                   k;
+    long                   ksrc;
+    double                 period_ns;
+    long                   spin_ns;
+    struct timespec        tstart;
+    struct timespec        tdeadline;
+    struct timespec        twake;
+    uint64_t               framecnt;
+    int64_t                late_ns;
+    int64_t               *toffset_ns = NULL;
+    double                 latemax_ns;
+    long                   NBframefed;
+    long                   NBoverrun;
+    IMAGE_BASIC_JITTERHIST jitterhist;
+    int                    semval;
+    const char            *ptr0;
+    char                  *ptr1;
+    int                    loopOK;
+
+    streamfeed_applyRT(src, out);
+
+    period_ns = 1.0e9 / frequ;
+    spin_ns   = 1000 * streamfeed_spinus;
 
     printf("frequ = %f Hz\n", frequ);
-    printf("tdelay = %ld us\n", tdelay);
+    printf("period = %.3f us\n", 1.0e-3 * period_ns);
 
-    IDs = image_ID(streamname);
-    if((xsize != data.image[IDs].md[0].size[0]) ||
-            (ysize != data.image[IDs].md[0].size[1]))
+    // lateness beyond which the schedule is restarted
+    latemax_ns = period_ns;
+    if(streamfeed_tstampname[0] != '\0')
     {
-        printf("ERROR: images have different x and y sizes");
-        exit(0);
+        toffset_ns = streamfeed_loadtimestamps(src->NBframe, period_ns);
+        if(toffset_ns == NULL)
+        {
+            return -1;
+        }
+        latemax_ns = 1.0 * toffset_ns[src->NBframe] / src->NBframe;
     }
-    zsize = data.image[ID].md[0].size[2];
 
-    ptr1 = (char *) data.image[IDs].array.F; // destination
+    for(int o = 0; o < out->NBout; o++)
+    {
+        imageID IDs = out->ID[o];
+
+        out->NBslice[o] = 1;
+        if(streamfeed_cbuffmode == 1)
+        {
+            if(data.image[IDs].md[0].naxis != 3)
+            {
+                printf("ERROR: circular buffer mode requires 3D output "
+                       "stream");
+                exit(0);
+            }
+            out->NBslice[o] = data.image[IDs].md[0].size[2];
+            printf("circular buffer : %ld slices\n", out->NBslice[o]);
+        }
+        out->slice[o] = data.image[IDs].md[0].cnt1;
+
+        // offsets are taken modulo the sequence length
+        out->offset[o] %= src->NBframe;
+        if(out->offset[o] < 0)
+        {
+            out->offset[o] += src->NBframe;
+        }
+    }
+    if(out->NBout > 1)
+    {
+        printf("feeding %d streams\n", out->NBout);
+    }
 
     if(sigaction(SIGINT, &data.sigact, NULL) == -1)
     {
@@ -140,24 +899,122 @@ long IMAGE_BASIC_streamfeed(const char *__restrict IDname,
         exit(EXIT_FAILURE);
     }
 
-    k      = 0;
-    loopOK = 1;
+    if(src->mmapped == 1)
+    {
+        // small files are kept resident, larger ones are read 2 chunks ahead
+        streamfeed_advise(src,
+                          0,
+                          (src->NBframe > 2 * src->NBframechunk) ?
+                          2 * src->NBframechunk : src->NBframe,
+                          MADV_WILLNEED);
+    }
+
+    image_basic_jitterhist_init(&jitterhist);
+    NBoverrun = 0;
+    framecnt  = 0;
+    clock_gettime(CLOCK_MONOTONIC, &tstart);
+
+    k          = 0;
+    NBframefed = 0;
+    loopOK     = 1;
     while(loopOK == 1)
     {
-        ptr0 = (char *) data.image[ID].array.F;
-        ptr0 += sizeof(float) * xysize * k;
-        data.image[IDs].md[0].write = 1;
-        memcpy((void *) ptr1, (void *) ptr0, sizeof(float) * xysize);
+        tdeadline = tstart;
+        if(toffset_ns != NULL)
+        {
+            image_basic_timespec_add_ns(&tdeadline, toffset_ns[k]);
+        }
+        else
+        {
+            image_basic_timespec_add_ns(&tdeadline,
+                                        (int64_t)(framecnt * period_ns + 0.5));
+        }
+        image_basic_sleep_until(&tdeadline, spin_ns);
 
-        data.image[IDs].md[0].write = 0;
-        data.image[IDs].md[0].cnt0++;
-        COREMOD_MEMORY_image_set_sempost_byID(IDs, -1);
+        clock_gettime(CLOCK_MONOTONIC, &twake);
+        late_ns = image_basic_timespec_diff_ns(&tdeadline, &twake);
+        image_basic_jitterhist_add(&jitterhist, late_ns);
+        framecnt++;
+        if(late_ns > latemax_ns)
+        {
+            // more than one (average) frame late : restart the schedule
+            // from now instead of bursting frames to catch up
+            NBoverrun++;
+            tstart   = twake;
+            framecnt = 1;
+            if(toffset_ns != NULL)
+            {
+                image_basic_timespec_add_ns(&tstart, -toffset_ns[k]);
+            }
+        }
+
+        for(int o = 0; o < out->NBout; o++)
+        {
+            imageID IDs = out->ID[o];
+
+            ksrc = k + out->offset[o];
+            if(ksrc >= src->NBframe)
+            {
+                ksrc -= src->NBframe;
+            }
+            ptr0 = src->ptr + src->framesize * ksrc;
+            out->slice[o]++;
+            if(out->slice[o] >= out->NBslice[o])
+            {
+                out->slice[o] = 0;
+            }
+            ptr1 = (char *) data.image[IDs].array.raw +
+                   src->framesize * out->slice[o];
+            data.image[IDs].md[0].write = 1;
+            clock_gettime(CLOCK_REALTIME, &data.image[IDs].md[0].atime);
+            memcpy((void *) ptr1, (void *) ptr0, src->framesize);
+            if(src->fitsdata == 1)
+            {
+                image_basic_fits_unswap(ptr1, src->nelement, src->datatype);
+            }
+        }
+
+        // consumers measure latency from writetime
+        for(int o = 0; o < out->NBout; o++)
+        {
+            imageID IDs = out->ID[o];
+
+            clock_gettime(CLOCK_REALTIME, &data.image[IDs].md[0].writetime);
+            data.image[IDs].md[0].cnt1  = out->slice[o];
+            data.image[IDs].md[0].write = 0;
+            data.image[IDs].md[0].cnt0++;
+            COREMOD_MEMORY_image_set_sempost_byID(IDs, -1);
+        }
 
-        usleep(tdelay);
         k++;
-        if(k == zsize)
+        if(k == src->NBframe)
         {
             k = 0;
+            if(toffset_ns != NULL)
+            {
+                image_basic_timespec_add_ns(&tstart,
+                                            toffset_ns[src->NBframe]);
+            }
+        }
+
+        if((src->mmapped == 1) && (src->NBframe > 2 * src->NBframechunk) &&
+                (k % src->NBframechunk == 0))
+        {
+            // read next chunks ahead, release chunk behind
+            streamfeed_advise(src,
+                              k + src->NBframechunk,
+                              src->NBframechunk,
+                              MADV_WILLNEED);
+            streamfeed_advise(src,
+                              k + src->NBframe - src->NBframechunk,
+                              src->NBframechunk,
+                              MADV_DONTNEED);
+        }
+
+        NBframefed++;
+        if(NBframefed == streamfeed_NBframemax)
+        {
+            loopOK = 0;
         }
 
         if((data.signal_INT == 1) || (data.signal_TERM == 1) ||
@@ -169,21 +1026,216 @@ long IMAGE_BASIC_streamfeed(const char *__restrict IDname,
         }
     }
 
-    data.image[IDs].md[0].write = 1;
-    for(ii = 0; ii < xysize; ii++)
+    image_basic_jitterhist_print(&jitterhist, "frame wake-up jitter");
+    printf("    %ld schedule overrun(s)\n", NBoverrun);
+    if(streamfeed_jittername[0] != '\0')
     {
-        data.image[IDs].array.F[ii] = 0.0;
+        image_basic_jitterhist_to_image(&jitterhist, streamfeed_jittername);
     }
-    if(data.image[IDs].md[0].sem > 0)
+
+    for(int o = 0; o < out->NBout; o++)
     {
-        sem_getvalue(data.image[IDs].semptr[0], &semval);
-        if(semval < SEMAPHORE_MAXVAL)
+        imageID IDs = out->ID[o];
+
+        out->slice[o]++;
+        if(out->slice[o] >= out->NBslice[o])
+        {
+            out->slice[o] = 0;
+        }
+        data.image[IDs].md[0].write = 1;
+        memset((char *) data.image[IDs].array.raw +
+               src->framesize * out->slice[o],
+               0,
+               src->framesize);
+        data.image[IDs].md[0].cnt1 = out->slice[o];
+        if(data.image[IDs].md[0].sem > 0)
         {
-            sem_post(data.image[IDs].semptr[0]);
+            sem_getvalue(data.image[IDs].semptr[0], &semval);
+            if(semval < SEMAPHORE_MAXVAL)
+            {
+                sem_post(data.image[IDs].semptr[0]);
+            }
         }
+        data.image[IDs].md[0].write = 0;
+        data.image[IDs].md[0].cnt0++;
     }
-    data.image[IDs].md[0].write = 0;
-    data.image[IDs].md[0].cnt0++;
+
+    free(toffset_ns);
 
     return (0);
 }
+
+// feed image to data stream
+// all datatypes, input and stream datatypes must match
+//
+// frames are paced on absolute CLOCK_MONOTONIC deadlines t0 + k / frequ,
+// so copy time and wake-up latency do not accumulate into the frame rate
+//
+// streamname may be a comma-separated list of streams, each optionally
+// followed by a source frame offset (e.g. "wfs0,wfs1:10,wfs2:20") : all
+// streams are then fed from the same loop, phase-aligned, and the source
+// frame is read once per tick
+long IMAGE_BASIC_streamfeed(const char *__restrict IDname,
+                            const char *__restrict streamname,
+                            float frequ)
+{
+    imageID           ID;
+    long              xsize, ysize;
+    STREAMFEED_SOURCE src;
+    STREAMFEED_OUTPUT out;
+
+    ID    = image_ID(IDname);
+    xsize = data.image[ID].md[0].size[0];
+    ysize = data.image[ID].md[0].size[1];
+
+    if(streamfeed_parseoutput(streamname, &out) < 1)
+    {
+        return -1;
+    }
+    streamfeed_checkoutput(&out, xsize, ysize, data.image[ID].md[0].datatype);
+
+    memset(&src, 0, sizeof(STREAMFEED_SOURCE));
+    src.ptr       = (const char *) data.image[ID].array.raw;
+    src.datatype  = data.image[ID].md[0].datatype;
+    src.nelement  = xsize * ysize;
+    src.framesize = ImageStreamIO_typesize(src.datatype) * src.nelement;
+    src.NBframe   = 1;
+    if(data.image[ID].md[0].naxis == 3)
+    {
+        src.NBframe = data.image[ID].md[0].size[2];
+    }
+
+    return streamfeed_loop(&src, &out, frequ);
+}
+
+// feed frames of a FITS or raw cube file to data stream
+//
+// The file is memory-mapped and never loaded as a whole : chunks of frames
+// are prefetched (madvise WILLNEED) ahead of the feed pointer and released
+// behind it, so files larger than RAM can be replayed from disk.
+// FITS files must match stream size and datatype. Raw files are read as
+// consecutive frames of the stream size and datatype.
+// streamname may list several streams, as for IMAGE_BASIC_streamfeed.
+long IMAGE_BASIC_streamfeed_file(const char *__restrict fname,
+                                 const char *__restrict streamname,
+                                 float frequ)
+{
+    imageID           IDs;
+    STREAMFEED_SOURCE src;
+    STREAMFEED_OUTPUT out;
+    struct stat       filestat;
+    int               fd;
+    char             *map;
+    long              headersize = 0;
+    size_t            NBframefile;
+    long              naxes[3]   = {0, 0, 1};
+    int               naxis;
+    uint8_t           datatype;
+    long              ret;
+
+    if(streamfeed_parseoutput(streamname, &out) < 1)
+    {
+        return -1;
+    }
+    IDs = out.ID[0];
+    streamfeed_checkoutput(&out,
+                           data.image[IDs].md[0].size[0],
+                           data.image[IDs].md[0].size[1],
+                           data.image[IDs].md[0].datatype);
+
+    fd = open(fname, O_RDONLY);
+    if(fd == -1)
+    {
+        PRINT_ERROR("cannot open file %s", fname);
+        return -1;
+    }
+    if((fstat(fd, &filestat) == -1) || (filestat.st_size == 0))
+    {
+        PRINT_ERROR("cannot stat file %s, or file is empty", fname);
+        close(fd);
+        return -1;
+    }
+    map = (char *) mmap(NULL, filestat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        PRINT_ERROR("mmap error");
+        return -1;
+    }
+    madvise(map, filestat.st_size, MADV_SEQUENTIAL);
+
+    memset(&src, 0, sizeof(STREAMFEED_SOURCE));
+    src.datatype  = data.image[IDs].md[0].datatype;
+    src.nelement  = (uint64_t) data.image[IDs].md[0].size[0] *
+                    data.image[IDs].md[0].size[1];
+    src.framesize = ImageStreamIO_typesize(src.datatype) * src.nelement;
+
+    if(strncmp(map, "SIMPLE  =", 9) == 0)
+    {
+        headersize = image_basic_fits_readheader(map,
+                     filestat.st_size,
+                     &datatype,
+                     &naxis,
+                     naxes);
+        if((headersize == 0) || (datatype != src.datatype) ||
+                (naxes[0] != data.image[IDs].md[0].size[0]) ||
+                (naxes[1] != data.image[IDs].md[0].size[1]))
+        {
+            printf("ERROR: file %s does not match stream %s\n",
+                   fname,
+                   streamname);
+            munmap(map, filestat.st_size);
+            return -1;
+        }
+        src.fitsdata = 1;
+        src.NBframe  = naxes[2];
+
+        // truncated or still being written : only replay complete frames
+        NBframefile = 0;
+        if(filestat.st_size >= headersize)
+        {
+            NBframefile =
+                (size_t)(filestat.st_size - headersize) / src.framesize;
+        }
+        if((size_t) src.NBframe > NBframefile)
+        {
+            src.NBframe = NBframefile;
+            printf("WARNING: file %s holds %ld of %ld frames\n",
+                   fname,
+                   src.NBframe,
+                   naxes[2]);
+        }
+    }
+    else
+    {
+        src.NBframe = filestat.st_size / src.framesize;
+    }
+    if(src.NBframe < 1)
+    {
+        printf("ERROR: no frame in file %s\n", fname);
+        munmap(map, filestat.st_size);
+        return -1;
+    }
+
+    src.ptr          = map + headersize;
+    src.mmapped      = 1;
+    src.NBframechunk = STREAMFEED_CHUNKSIZE / src.framesize;
+    if(src.NBframechunk < 1)
+    {
+        src.NBframechunk = 1;
+    }
+    if(src.NBframechunk > src.NBframe)
+    {
+        src.NBframechunk = src.NBframe;
+    }
+    printf("file %s : %ld frames, prefetch %ld frames ahead\n",
+           fname,
+           src.NBframe,
+           src.NBframechunk);
+
+    ret = streamfeed_loop(&src, &out, frequ);
+
+    munmap(map, filestat.st_size);
+
+    return ret;
+}
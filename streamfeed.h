@@ -1,8 +1,47 @@
 /** @file streamfeed.h
  */
 
+#ifndef _IMAGE_BASIC_STREAMFEED_H
+#define _IMAGE_BASIC_STREAMFEED_H
+
+// per-call feed settings, see image_basic_streamfeed_savesettings()
+typedef struct
+{
+    int  cbuffmode;
+    char tstampname[STRINGMAXLEN_IMGNAME];
+    long NBframemax;
+} IMAGE_BASIC_STREAMFEED_SETTINGS;
+
 errno_t __attribute__((cold)) streamfeed_addCLIcmd();
 
 long IMAGE_BASIC_streamfeed(const char *__restrict IDname,
                             const char *__restrict streamname,
                             float frequ);
+
+long IMAGE_BASIC_streamfeed_file(const char *__restrict fname,
+                                 const char *__restrict streamname,
+                                 float frequ);
+
+errno_t IMAGE_BASIC_streamfeed_settiming(long spinus,
+        const char *__restrict IDjitter_name);
+
+errno_t IMAGE_BASIC_streamfeed_setcbuff(int cbuffmode);
+
+errno_t IMAGE_BASIC_streamfeed_settimestamps(
+    const char *__restrict IDtiming_name);
+
+errno_t IMAGE_BASIC_streamfeed_setNBframe(long NBframemax);
+
+void image_basic_streamfeed_savesettings(
+    IMAGE_BASIC_STREAMFEED_SETTINGS *settings);
+
+void image_basic_streamfeed_restoresettings(
+    const IMAGE_BASIC_STREAMFEED_SETTINGS *settings);
+
+errno_t IMAGE_BASIC_streamfeed_setRT(const char *__restrict cpuset,
+                                     const char *__restrict policy,
+                                     int priority,
+                                     int memlock,
+                                     int prefault);
+
+#endif
@@ -0,0 +1,705 @@
+/** @file streamfits.c
+ *
+ * Minimal FITS primary header and data conversion helpers, used to
+ * stream frames to/from FITS files without going through an image.
+ * Also writes tile-compressed (RICE_1) FITS, one tile per frame.
+ */
+
+#include <byteswap.h>
+
+#include "CommandLineInterface/CLIcore.h"
+
+#include "streamfits.h"
+
+/* FITS BITPIX for datatype
+ * unsigned (and int8) types are stored as signed with offset bzero
+ * returns 0 if datatype has no FITS equivalent
+ */
+int image_basic_fits_bitpix(uint8_t datatype, double *bzero)
+{
+    int bitpix = 0;
+
+    *bzero = 0.0;
+    switch(datatype)
+    {
+        case _DATATYPE_UINT8:
+            bitpix = 8;
+            break;
+        case _DATATYPE_INT8:
+            bitpix = 8;
+            *bzero = -128.0;
+            break;
+        case _DATATYPE_UINT16:
+            bitpix = 16;
+            *bzero = 32768.0;
+            break;
+        case _DATATYPE_INT16:
+            bitpix = 16;
+            break;
+        case _DATATYPE_UINT32:
+            bitpix = 32;
+            *bzero = 2147483648.0;
+            break;
+        case _DATATYPE_INT32:
+            bitpix = 32;
+            break;
+        case _DATATYPE_UINT64:
+            bitpix = 64;
+            *bzero = 9223372036854775808.0;
+            break;
+        case _DATATYPE_INT64:
+            bitpix = 64;
+            break;
+        case _DATATYPE_FLOAT:
+            bitpix = -32;
+            break;
+        case _DATATYPE_DOUBLE:
+            bitpix = -64;
+            break;
+    }
+
+    return bitpix;
+}
+
+static char *fits_card(char *card, const char *key, const char *value)
+{
+    char tmp[81];
+
+    snprintf(tmp, 81, "%-8.8s= %20s", key, value);
+    memset(card, ' ', 80);
+    memcpy(card, tmp, strlen(tmp));
+
+    return card + 80;
+}
+
+// string valued card, quoted value starts in column 11
+static char *fits_cardstr(char *card, const char *key, const char *value)
+{
+    char tmp[81];
+
+    snprintf(tmp, 81, "%-8.8s= '%-8s'", key, value);
+    memset(card, ' ', 80);
+    memcpy(card, tmp, strlen(tmp));
+
+    return card + 80;
+}
+
+/* write primary header into header buffer
+ * header must hold IMAGE_BASIC_FITS_BLOCKSIZE bytes
+ * returns header size [bytes], 0 if datatype or naxis cannot be written
+ * to FITS
+ */
+long image_basic_fits_imageheader(char       *header,
+                                  uint8_t     datatype,
+                                  int         naxis,
+                                  const long *naxes)
+{
+    char   value[21];
+    char   key[9];
+    char  *card = header;
+    int    bitpix;
+    double bzero;
+
+    bitpix = image_basic_fits_bitpix(datatype, &bzero);
+    if(bitpix == 0)
+    {
+        return 0;
+    }
+
+    memset(header, ' ', IMAGE_BASIC_FITS_BLOCKSIZE);
+
+    card = fits_card(card, "SIMPLE", "T");
+    snprintf(value, 21, "%d", bitpix);
+    card = fits_card(card, "BITPIX", value);
+    snprintf(value, 21, "%d", naxis);
+    card = fits_card(card, "NAXIS", value);
+    for(int axis = 0; axis < naxis; axis++)
+    {
+        if(snprintf(key, 9, "NAXIS%d", axis + 1) >= 9)
+        {
+            return 0;
+        }
+        snprintf(value, 21, "%ld", naxes[axis]);
+        card = fits_card(card, key, value);
+    }
+    if(bzero != 0.0)
+    {
+        snprintf(value, 21, "%.0f", bzero);
+        card = fits_card(card, "BZERO", value);
+        card = fits_card(card, "BSCALE", "1");
+    }
+    memcpy(card, "END", 3);
+
+    return IMAGE_BASIC_FITS_BLOCKSIZE;
+}
+
+/* convert nelement native values to FITS representation, in place
+ * swaps to big endian and applies the bzero offset of unsigned types
+ * (sign bit flip)
+ */
+void image_basic_fits_swap(void *buf, uint64_t nelement, uint8_t datatype)
+{
+    switch(datatype)
+    {
+        case _DATATYPE_INT8:
+        {
+            uint8_t *ptr = (uint8_t *) buf;
+            for(uint64_t ii = 0; ii < nelement; ii++)
+            {
+                ptr[ii] ^= 0x80;
+            }
+        }
+        break;
+
+        case _DATATYPE_UINT16:
+        case _DATATYPE_INT16:
+        {
+            uint16_t *ptr  = (uint16_t *) buf;
+            uint16_t  flip = (datatype == _DATATYPE_UINT16) ? 0x80 : 0;
+            for(uint64_t ii = 0; ii < nelement; ii++)
+            {
+                ptr[ii] = bswap_16(ptr[ii]) ^ flip;
+            }
+        }
+        break;
+
+        case _DATATYPE_UINT32:
+        case _DATATYPE_INT32:
+        case _DATATYPE_FLOAT:
+        {
+            uint32_t *ptr  = (uint32_t *) buf;
+            uint32_t  flip = (datatype == _DATATYPE_UINT32) ? 0x80 : 0;
+            for(uint64_t ii = 0; ii < nelement; ii++)
+            {
+                ptr[ii] = bswap_32(ptr[ii]) ^ flip;
+            }
+        }
+        break;
+
+        case _DATATYPE_UINT64:
+        case _DATATYPE_INT64:
+        case _DATATYPE_DOUBLE:
+        {
+            uint64_t *ptr  = (uint64_t *) buf;
+            uint64_t  flip = (datatype == _DATATYPE_UINT64) ? 0x80 : 0;
+            for(uint64_t ii = 0; ii < nelement; ii++)
+            {
+                ptr[ii] = bswap_64(ptr[ii]) ^ flip;
+            }
+        }
+        break;
+    }
+}
+
+/* convert nelement FITS values to native representation, in place
+ * inverse of image_basic_fits_swap
+ */
+void image_basic_fits_unswap(void *buf, uint64_t nelement, uint8_t datatype)
+{
+    switch(datatype)
+    {
+        case _DATATYPE_INT8:
+        {
+            uint8_t *ptr = (uint8_t *) buf;
+            for(uint64_t ii = 0; ii < nelement; ii++)
+            {
+                ptr[ii] ^= 0x80;
+            }
+        }
+        break;
+
+        case _DATATYPE_UINT16:
+        case _DATATYPE_INT16:
+        {
+            uint16_t *ptr  = (uint16_t *) buf;
+            uint16_t  flip = (datatype == _DATATYPE_UINT16) ? 0x80 : 0;
+            for(uint64_t ii = 0; ii < nelement; ii++)
+            {
+                ptr[ii] = bswap_16(ptr[ii] ^ flip);
+            }
+        }
+        break;
+
+        case _DATATYPE_UINT32:
+        case _DATATYPE_INT32:
+        case _DATATYPE_FLOAT:
+        {
+            uint32_t *ptr  = (uint32_t *) buf;
+            uint32_t  flip = (datatype == _DATATYPE_UINT32) ? 0x80 : 0;
+            for(uint64_t ii = 0; ii < nelement; ii++)
+            {
+                ptr[ii] = bswap_32(ptr[ii] ^ flip);
+            }
+        }
+        break;
+
+        case _DATATYPE_UINT64:
+        case _DATATYPE_INT64:
+        case _DATATYPE_DOUBLE:
+        {
+            uint64_t *ptr  = (uint64_t *) buf;
+            uint64_t  flip = (datatype == _DATATYPE_UINT64) ? 0x80 : 0;
+            for(uint64_t ii = 0; ii < nelement; ii++)
+            {
+                ptr[ii] = bswap_64(ptr[ii] ^ flip);
+            }
+        }
+        break;
+    }
+}
+
+// integer value of header card, card must start with key
+static long fits_cardvalue(const char *card)
+{
+    char value[71];
+
+    memcpy(value, card + 10, 70);
+    value[70] = '\0';
+
+    return atol(value);
+}
+
+/* parse primary header of FITS image at start of buf (size bytes)
+ * returns header size [bytes], 0 if not a FITS image this module can read
+ * naxes must hold 3 values
+ */
+long image_basic_fits_readheader(const char *buf,
+                                 size_t      size,
+                                 uint8_t    *datatype,
+                                 int        *naxis,
+                                 long       *naxes)
+{
+    int    bitpix = 0;
+    double bzero  = 0.0;
+    long   card;
+    long   NBcardmax = size / 80;
+    char   key[9];
+
+    *naxis = 0;
+    for(card = 0; card < NBcardmax; card++)
+    {
+        const char *cardptr = buf + 80 * card;
+
+        if(strncmp(cardptr, "END     ", 8) == 0)
+        {
+            break;
+        }
+        if(strncmp(cardptr, "BITPIX  =", 9) == 0)
+        {
+            bitpix = (int) fits_cardvalue(cardptr);
+        }
+        if(strncmp(cardptr, "NAXIS   =", 9) == 0)
+        {
+            *naxis = (int) fits_cardvalue(cardptr);
+        }
+        for(int axis = 0; axis < 3; axis++)
+        {
+            if(snprintf(key, 9, "NAXIS%d", axis + 1) >= 9)
+        {
+            return 0;
+        }
+            if((strncmp(cardptr, key, strlen(key)) == 0) &&
+                    (cardptr[8] == '='))
+            {
+                naxes[axis] = fits_cardvalue(cardptr);
+            }
+        }
+        if(strncmp(cardptr, "BZERO   =", 9) == 0)
+        {
+            bzero = atof(cardptr + 10);
+        }
+        if(strncmp(cardptr, "BSCALE  =", 9) == 0)
+        {
+            if(atof(cardptr + 10) != 1.0)
+            {
+                return 0;
+            }
+        }
+    }
+    if((card == NBcardmax) || (*naxis < 2) || (*naxis > 3))
+    {
+        return 0;
+    }
+
+    switch(bitpix)
+    {
+        case 8:
+            *datatype = (bzero == 0.0) ? _DATATYPE_UINT8 : _DATATYPE_INT8;
+            break;
+        case 16:
+            *datatype = (bzero == 0.0) ? _DATATYPE_INT16 : _DATATYPE_UINT16;
+            break;
+        case 32:
+            *datatype = (bzero == 0.0) ? _DATATYPE_INT32 : _DATATYPE_UINT32;
+            break;
+        case 64:
+            *datatype = (bzero == 0.0) ? _DATATYPE_INT64 : _DATATYPE_UINT64;
+            break;
+        case -32:
+            *datatype = _DATATYPE_FLOAT;
+            break;
+        case -64:
+            *datatype = _DATATYPE_DOUBLE;
+            break;
+        default:
+            return 0;
+    }
+
+    return (80 * (card + 1) + IMAGE_BASIC_FITS_BLOCKSIZE - 1) /
+           IMAGE_BASIC_FITS_BLOCKSIZE * IMAGE_BASIC_FITS_BLOCKSIZE;
+}
+
+// ==========================================
+// Tile-compressed FITS (RICE_1)
+// ==========================================
+
+// Rice coder bit output
+typedef struct
+{
+    unsigned char *ptr;
+    unsigned char *end;
+    uint64_t       bitbuffer;
+    int            nbits; // pending bits in bitbuffer, < 32 between calls
+    int            overflow;
+} RICE_BITOUT;
+
+// write n low bits of bits, msb first, n <= 32
+// output is flushed 32 bits at a time
+static inline void rice_putbits(RICE_BITOUT *out, uint32_t bits, int n)
+{
+    out->bitbuffer = (out->bitbuffer << n) |
+                     (bits & (uint32_t)((1ULL << n) - 1));
+    out->nbits += n;
+    if(out->nbits >= 32)
+    {
+        uint32_t word;
+
+        out->nbits -= 32;
+        word = (uint32_t)(out->bitbuffer >> out->nbits);
+        if(out->end - out->ptr >= 4)
+        {
+            out->ptr[0] = (unsigned char)(word >> 24);
+            out->ptr[1] = (unsigned char)(word >> 16);
+            out->ptr[2] = (unsigned char)(word >> 8);
+            out->ptr[3] = (unsigned char) word;
+            out->ptr += 4;
+        }
+        else
+        {
+            out->overflow = 1;
+        }
+    }
+}
+
+// write pending bits, zero-padded to a byte boundary
+static void rice_flushbits(RICE_BITOUT *out)
+{
+    while(out->nbits > 0)
+    {
+        int shift = out->nbits - 8;
+
+        if(out->ptr < out->end)
+        {
+            *out->ptr++ = (unsigned char)((shift >= 0)
+                                          ? (out->bitbuffer >> shift)
+                                          : (out->bitbuffer << -shift));
+        }
+        else
+        {
+            out->overflow = 1;
+        }
+        out->nbits -= 8;
+    }
+    out->nbits = 0;
+}
+
+/* Rice-compress one block of mapped differences, as FITS RICE_1
+ * (same code stream as the CFITSIO fits_rcomp* functions)
+ */
+static void rice_block(RICE_BITOUT        *out,
+                       const unsigned int *diff,
+                       int                 nblock,
+                       double              pixelsum,
+                       int                 fsbits,
+                       int                 fsmax,
+                       int                 bbits)
+{
+    double       dpsum;
+    unsigned int psum;
+    int          fs;
+
+    // number of bits split from each value
+    dpsum = (pixelsum - (nblock / 2) - 1) / nblock;
+    if(dpsum < 0)
+    {
+        dpsum = 0.0;
+    }
+    psum = ((unsigned int) dpsum) >> 1;
+    for(fs = 0; psum > 0; fs++)
+    {
+        psum >>= 1;
+    }
+
+    if(fs >= fsmax)
+    {
+        // high entropy : differences written verbatim
+        rice_putbits(out, fsmax + 1, fsbits);
+        for(int j = 0; j < nblock; j++)
+        {
+            rice_putbits(out, diff[j], bbits);
+        }
+    }
+    else if((fs == 0) && (pixelsum == 0))
+    {
+        // all differences zero
+        rice_putbits(out, 0, fsbits);
+    }
+    else
+    {
+        unsigned int fsmask = (1u << fs) - 1;
+
+        rice_putbits(out, fs + 1, fsbits);
+        for(int j = 0; j < nblock; j++)
+        {
+            unsigned int top = diff[j] >> fs;
+
+            // top coded as top zeros followed by a one, then fs low bits
+            while(top + fs >= 32)
+            {
+                rice_putbits(out, 0, 8);
+                top -= 8;
+            }
+            rice_putbits(out, (1u << fs) | (diff[j] & fsmask), top + fs + 1);
+        }
+    }
+}
+
+/* Rice-compress nelement integer values of datatype into out
+ *
+ * Values are coded as their FITS representation (unsigned types offset
+ * by bzero), so the result is the RICE_1 tile of the FITS image holding
+ * them. Supports 8, 16 and 32 bit integer types.
+ *
+ * returns compressed size [bytes], -1 if outsize is too small or the
+ * datatype is not supported
+ */
+long image_basic_fits_ricecomp(const void    *in,
+                               uint64_t       nelement,
+                               uint8_t        datatype,
+                               unsigned char *out,
+                               size_t         outsize,
+                               int            blocksize)
+{
+    RICE_BITOUT  bitout;
+    unsigned int diff[IMAGE_BASIC_FITS_RICE_MAXBLOCK];
+    int          nbit;
+    int          fsbits;
+    int          fsmax;
+    uint32_t     flip = 0;
+    uint32_t     mask;
+
+    switch(datatype)
+    {
+        case _DATATYPE_UINT8:
+        case _DATATYPE_INT8:
+            nbit   = 8;
+            fsbits = 3;
+            fsmax  = 6;
+            flip   = (datatype == _DATATYPE_INT8) ? 0x80 : 0;
+            break;
+        case _DATATYPE_UINT16:
+        case _DATATYPE_INT16:
+            nbit   = 16;
+            fsbits = 4;
+            fsmax  = 14;
+            flip   = (datatype == _DATATYPE_UINT16) ? 0x8000 : 0;
+            break;
+        case _DATATYPE_UINT32:
+        case _DATATYPE_INT32:
+            nbit   = 32;
+            fsbits = 5;
+            fsmax  = 25;
+            flip   = (datatype == _DATATYPE_UINT32) ? 0x80000000 : 0;
+            break;
+        default:
+            return -1;
+    }
+    if((blocksize < 1) || (blocksize > IMAGE_BASIC_FITS_RICE_MAXBLOCK) ||
+            (nelement == 0))
+    {
+        return -1;
+    }
+    mask = (nbit == 32) ? 0xffffffff : ((1u << nbit) - 1);
+
+    bitout.ptr       = out;
+    bitout.end       = out + outsize;
+    bitout.bitbuffer = 0;
+    bitout.nbits     = 0;
+    bitout.overflow  = 0;
+
+#define RICECOMP(type)                                                         \
+    {                                                                          \
+        const type *ptr     = (const type *) in;                               \
+        uint32_t    lastpix = ((uint32_t) ptr[0] ^ flip) & mask;               \
+        rice_putbits(&bitout, lastpix, nbit);                                  \
+        for(uint64_t i = 0; i < nelement; i += blocksize)                      \
+        {                                                                      \
+            int    nblock   = blocksize;                                       \
+            double pixelsum = 0.0;                                             \
+            if(nelement - i < (uint64_t) blocksize)                            \
+            {                                                                  \
+                nblock = nelement - i;                                         \
+            }                                                                  \
+            for(int j = 0; j < nblock; j++)                                    \
+            {                                                                  \
+                uint32_t nextpix = ((uint32_t) ptr[i + j] ^ flip) & mask;      \
+                uint32_t d       = (nextpix - lastpix) & mask;                 \
+                int32_t  pdiff;                                                \
+                /* sign-extend difference from nbit bits */                    \
+                if(nbit == 32)                                                 \
+                {                                                              \
+                    pdiff = (int32_t) d;                                       \
+                }                                                              \
+                else                                                           \
+                {                                                              \
+                    pdiff = (int32_t)(d << (32 - nbit)) >> (32 - nbit);        \
+                }                                                              \
+                diff[j] = (pdiff < 0) ? ~((uint32_t) pdiff << 1)               \
+                          : ((uint32_t) pdiff << 1);                           \
+                pixelsum += diff[j];                                           \
+                lastpix = nextpix;                                             \
+            }                                                                  \
+            rice_block(&bitout, diff, nblock, pixelsum, fsbits, fsmax, nbit);  \
+        }                                                                      \
+    }                                                                          \
+    break;
+
+    switch(datatype)
+    {
+        case _DATATYPE_UINT8:
+            RICECOMP(uint8_t)
+        case _DATATYPE_INT8:
+            RICECOMP(int8_t)
+        case _DATATYPE_UINT16:
+            RICECOMP(uint16_t)
+        case _DATATYPE_INT16:
+            RICECOMP(int16_t)
+        case _DATATYPE_UINT32:
+            RICECOMP(uint32_t)
+        case _DATATYPE_INT32:
+            RICECOMP(int32_t)
+    }
+
+#undef RICECOMP
+
+    // flush last bits
+    rice_flushbits(&bitout);
+    if(bitout.overflow == 1)
+    {
+        return -1;
+    }
+
+    return bitout.ptr - out;
+}
+
+// empty primary header announcing extensions
+long image_basic_fits_emptyprimary(char *header)
+{
+    char *card = header;
+
+    memset(header, ' ', IMAGE_BASIC_FITS_BLOCKSIZE);
+    card = fits_card(card, "SIMPLE", "T");
+    card = fits_card(card, "BITPIX", "8");
+    card = fits_card(card, "NAXIS", "0");
+    card = fits_card(card, "EXTEND", "T");
+    memcpy(card, "END", 3);
+
+    return IMAGE_BASIC_FITS_BLOCKSIZE;
+}
+
+/* write tile-compressed image extension header, one RICE_1 tile per frame
+ *
+ * NBframe     : number of frames (= table rows)
+ * NBrowmax    : rows reserved in front of the heap (THEAP = 8 NBrowmax), so
+ *               that frames can be appended to the heap before NBframe is
+ *               known
+ * heapsize    : heap size [bytes]
+ * maxtilesize : largest compressed tile [bytes]
+ *
+ * header must hold IMAGE_BASIC_FITS_BLOCKSIZE bytes
+ * returns header size [bytes], 0 if datatype cannot be Rice-compressed
+ */
+long image_basic_fits_riceheader(char   *header,
+                                 uint8_t datatype,
+                                 long    xsize,
+                                 long    ysize,
+                                 long    NBframe,
+                                 long    NBrowmax,
+                                 long    heapsize,
+                                 long    maxtilesize,
+                                 int     blocksize)
+{
+    char   value[21];
+    char   tform[21];
+    char  *card = header;
+    int    bitpix;
+    int    bytepix;
+    double bzero;
+
+    bitpix = image_basic_fits_bitpix(datatype, &bzero);
+    if((bitpix != 8) && (bitpix != 16) && (bitpix != 32))
+    {
+        return 0;
+    }
+    bytepix = bitpix / 8;
+
+    memset(header, ' ', IMAGE_BASIC_FITS_BLOCKSIZE);
+
+    card = fits_cardstr(card, "XTENSION", "BINTABLE");
+    card = fits_card(card, "BITPIX", "8");
+    card = fits_card(card, "NAXIS", "2");
+    card = fits_card(card, "NAXIS1", "8");
+    snprintf(value, 21, "%ld", NBframe);
+    card = fits_card(card, "NAXIS2", value);
+    // PCOUNT includes the gap between table and heap
+    snprintf(value, 21, "%ld", 8 * (NBrowmax - NBframe) + heapsize);
+    card = fits_card(card, "PCOUNT", value);
+    card = fits_card(card, "GCOUNT", "1");
+    card = fits_card(card, "TFIELDS", "1");
+    card = fits_cardstr(card, "TTYPE1", "COMPRESSED_DATA");
+    snprintf(tform, 21, "1PB(%ld)", maxtilesize);
+    card = fits_cardstr(card, "TFORM1", tform);
+    snprintf(value, 21, "%ld", 8 * NBrowmax);
+    card = fits_card(card, "THEAP", value);
+    card = fits_card(card, "ZIMAGE", "T");
+    snprintf(value, 21, "%d", bitpix);
+    card = fits_card(card, "ZBITPIX", value);
+    card = fits_card(card, "ZNAXIS", "3");
+    snprintf(value, 21, "%ld", xsize);
+    card = fits_card(card, "ZNAXIS1", value);
+    snprintf(value, 21, "%ld", ysize);
+    card = fits_card(card, "ZNAXIS2", value);
+    snprintf(value, 21, "%ld", NBframe);
+    card = fits_card(card, "ZNAXIS3", value);
+    snprintf(value, 21, "%ld", xsize);
+    card = fits_card(card, "ZTILE1", value);
+    snprintf(value, 21, "%ld", ysize);
+    card = fits_card(card, "ZTILE2", value);
+    card = fits_card(card, "ZTILE3", "1");
+    card = fits_cardstr(card, "ZCMPTYPE", "RICE_1");
+    card = fits_cardstr(card, "ZNAME1", "BLOCKSIZE");
+    snprintf(value, 21, "%d", blocksize);
+    card = fits_card(card, "ZVAL1", value);
+    card = fits_cardstr(card, "ZNAME2", "BYTEPIX");
+    snprintf(value, 21, "%d", bytepix);
+    card = fits_card(card, "ZVAL2", value);
+    if(bzero != 0.0)
+    {
+        snprintf(value, 21, "%.0f", bzero);
+        card = fits_card(card, "BZERO", value);
+        card = fits_card(card, "BSCALE", "1");
+    }
+    memcpy(card, "END", 3);
+
+    return IMAGE_BASIC_FITS_BLOCKSIZE;
+}
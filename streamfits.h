@@ -0,0 +1,49 @@
+/** @file streamfits.h
+ */
+
+#ifndef _IMAGE_BASIC_STREAMFITS_H
+#define _IMAGE_BASIC_STREAMFITS_H
+
+#define IMAGE_BASIC_FITS_BLOCKSIZE 2880
+
+// RICE_1 block size used for tile compression, and largest supported
+#define IMAGE_BASIC_FITS_RICE_BLOCKSIZE 32
+#define IMAGE_BASIC_FITS_RICE_MAXBLOCK  64
+
+int image_basic_fits_bitpix(uint8_t datatype, double *bzero);
+
+long image_basic_fits_imageheader(char       *header,
+                                  uint8_t     datatype,
+                                  int         naxis,
+                                  const long *naxes);
+
+void image_basic_fits_swap(void *buf, uint64_t nelement, uint8_t datatype);
+
+void image_basic_fits_unswap(void *buf, uint64_t nelement, uint8_t datatype);
+
+long image_basic_fits_readheader(const char *buf,
+                                 size_t      size,
+                                 uint8_t    *datatype,
+                                 int        *naxis,
+                                 long       *naxes);
+
+long image_basic_fits_ricecomp(const void    *in,
+                               uint64_t       nelement,
+                               uint8_t        datatype,
+                               unsigned char *out,
+                               size_t         outsize,
+                               int            blocksize);
+
+long image_basic_fits_emptyprimary(char *header);
+
+long image_basic_fits_riceheader(char   *header,
+                                 uint8_t datatype,
+                                 long    xsize,
+                                 long    ysize,
+                                 long    NBframe,
+                                 long    NBrowmax,
+                                 long    heapsize,
+                                 long    maxtilesize,
+                                 int     blocksize);
+
+#endif
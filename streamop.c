@@ -0,0 +1,506 @@
+/** @file streamop.c
+ *
+ * Stream operator : applies a geometric transform (contract, rotate, resize,
+ * swapaxis) to each new frame of an input stream, writing the result into a
+ * preallocated output stream. Transforms are planned once, so the per-frame
+ * loop does no allocation and no image lookup.
+ */
+
+#include <math.h>
+
+#include "CommandLineInterface/CLIcore.h"
+
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "imcontract.h"
+#include "streamop.h"
+#include "streamrecord.h"
+#include "streamtiming.h"
+
+// gather map entry for output pixels with no input pixel
+#define STREAMOP_NOPIX UINT32_MAX
+
+#define STREAMOP_CONTRACT 0
+#define STREAMOP_ROTATE   1
+#define STREAMOP_RESIZE   2
+#define STREAMOP_SWAPAXIS 3
+
+typedef struct
+{
+    int      op;
+    uint32_t xsize; // input frame
+    uint32_t ysize;
+    uint8_t  datatype;
+    uint32_t xsizeout;
+    uint32_t ysizeout;
+    uint64_t nelementout;
+
+    // contract
+    int     n1;
+    int     n2;
+    double *accum;
+
+    // rotate, resize, swapaxis : output pixel ii is
+    // sum_k weight[NBterm ii + k] * in[index[NBterm ii + k]]
+    int       NBterm;
+    uint32_t *index;
+    float    *weight;
+} STREAMOP;
+
+// ==========================================
+// Forward declaration(s)
+// ==========================================
+
+long IMAGE_BASIC_streamop(const char *__restrict IDin_name,
+                          const char *__restrict IDout_name,
+                          const char *__restrict opname,
+                          float p1,
+                          float p2,
+                          long  NBframes);
+
+// ==========================================
+// Command line interface wrapper function(s)
+// ==========================================
+
+static errno_t IMAGE_BASIC_streamop_cli()
+{
+    if(0 + CLI_checkarg(1, 4) + CLI_checkarg(2, 5) + CLI_checkarg(3, 5) +
+            CLI_checkarg(4, 1) + CLI_checkarg(5, 1) + CLI_checkarg(6, 2) ==
+            0)
+    {
+        IMAGE_BASIC_streamop(data.cmdargtoken[1].val.string,
+                             data.cmdargtoken[2].val.string,
+                             data.cmdargtoken[3].val.string,
+                             data.cmdargtoken[4].val.numf,
+                             data.cmdargtoken[5].val.numf,
+                             data.cmdargtoken[6].val.numl);
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+// ==========================================
+// Register CLI command(s)
+// ==========================================
+
+errno_t __attribute__((cold)) streamop_addCLIcmd()
+{
+
+    RegisterCLIcommand(
+        "imgstreamop",
+        __FILE__,
+        IMAGE_BASIC_streamop_cli,
+        "apply geometric transform to each frame of a stream",
+        "<input stream> <output stream> "
+        "<op (contract/rotate/resize/swapaxis)> <p1> <p2> "
+        "<# frames, 0 until interrupted>",
+        "imgstreamop imstream imbin contract 2 2 0",
+        "long IMAGE_BASIC_streamop(const char *IDin_name, const char "
+        "*IDout_name, const char *opname, float p1, float p2, long "
+        "NBframes)");
+
+    return RETURN_SUCCESS;
+}
+
+static errno_t streamop_allocmap(STREAMOP *sop, int NBterm)
+{
+    sop->NBterm = NBterm;
+    sop->index =
+        (uint32_t *) malloc(sizeof(uint32_t) * NBterm * sop->nelementout);
+    sop->weight =
+        (float *) malloc(sizeof(float) * NBterm * sop->nelementout);
+    if((sop->index == NULL) || (sop->weight == NULL))
+    {
+        PRINT_ERROR("malloc returns NULL pointer");
+        abort();
+    }
+
+    return RETURN_SUCCESS;
+}
+
+/* plan transform : output size and gather map
+ *
+ * contract : p1 x p2 pixel sum, as basic_contract
+ * rotate   : rotation by p1 [rad], nearest pixel, as basic_rotate
+ * resize   : bilinear resize to p1 x p2, as basic_resizeim
+ * swapaxis : transpose, as image_basic_SwapAxis2D
+ */
+static errno_t
+streamop_plan(STREAMOP *sop, const char *opname, float p1, float p2)
+{
+    uint32_t xsize = sop->xsize;
+    uint32_t ysize = sop->ysize;
+
+    if(strcmp(opname, "contract") == 0)
+    {
+        sop->op = STREAMOP_CONTRACT;
+        sop->n1 = (int) p1;
+        sop->n2 = (int) p2;
+        if((sop->n1 < 1) || (sop->n2 < 1) || (sop->n1 > (int) xsize) ||
+                (sop->n2 > (int) ysize))
+        {
+            PRINT_ERROR("invalid contraction factors %d %d", sop->n1, sop->n2);
+            return RETURN_FAILURE;
+        }
+        sop->xsizeout    = xsize / sop->n1;
+        sop->ysizeout    = ysize / sop->n2;
+        sop->nelementout = (uint64_t) sop->xsizeout * sop->ysizeout;
+        sop->accum = (double *) malloc(sizeof(double) * sop->nelementout);
+        if(sop->accum == NULL)
+        {
+            PRINT_ERROR("malloc returns NULL pointer");
+            abort();
+        }
+    }
+    else if(strcmp(opname, "rotate") == 0)
+    {
+        double cosa = cos(p1);
+        double sina = sin(p1);
+
+        sop->op          = STREAMOP_ROTATE;
+        sop->xsizeout    = xsize;
+        sop->ysizeout    = ysize;
+        sop->nelementout = (uint64_t) xsize * ysize;
+        streamop_allocmap(sop, 1);
+        for(uint32_t jj = 0; jj < ysize; jj++)
+            for(uint32_t ii = 0; ii < xsize; ii++)
+            {
+                uint64_t pix = (uint64_t) jj * xsize + ii;
+                long     iis =
+                    (long)(xsize / 2 + ((long) ii - xsize / 2) * cosa +
+                           ((long) jj - ysize / 2) * sina);
+                long jjs = (long)(ysize / 2 - ((long) ii - xsize / 2) * sina +
+                                  ((long) jj - ysize / 2) * cosa);
+
+                sop->index[pix]  = STREAMOP_NOPIX;
+                sop->weight[pix] = 1.0;
+                if((iis > 0) && (jjs > 0) && (iis < xsize) && (jjs < ysize))
+                {
+                    sop->index[pix] = jjs * xsize + iis;
+                }
+            }
+    }
+    else if(strcmp(opname, "resize") == 0)
+    {
+        sop->op       = STREAMOP_RESIZE;
+        sop->xsizeout = (uint32_t) p1;
+        sop->ysizeout = (uint32_t) p2;
+        if((sop->xsizeout < 1) || (sop->ysizeout < 1))
+        {
+            PRINT_ERROR("invalid output size %u %u",
+                        sop->xsizeout,
+                        sop->ysizeout);
+            return RETURN_FAILURE;
+        }
+        sop->nelementout = (uint64_t) sop->xsizeout * sop->ysizeout;
+        streamop_allocmap(sop, 4);
+        for(uint32_t jj = 0; jj < sop->ysizeout; jj++)
+            for(uint32_t ii = 0; ii < sop->xsizeout; ii++)
+            {
+                uint64_t  pix = (uint64_t) jj * sop->xsizeout + ii;
+                uint32_t *idx = sop->index + 4 * pix;
+                float    *w   = sop->weight + 4 * pix;
+                float     xf1 = (float)(1.0 * ii / sop->xsizeout) * xsize;
+                float     yf1 = (float)(1.0 * jj / sop->ysizeout) * ysize;
+                long      ii1 = (long) xf1;
+                long      jj1 = (long) yf1;
+                float     uf  = xf1 - (float) ii1;
+                float     tf  = yf1 - (float) jj1;
+
+                idx[0] = STREAMOP_NOPIX;
+                if((ii1 + 1 < xsize) && (jj1 + 1 < ysize))
+                {
+                    idx[0] = jj1 * xsize + ii1;
+                    idx[1] = jj1 * xsize + ii1 + 1;
+                    idx[2] = (jj1 + 1) * xsize + ii1;
+                    idx[3] = (jj1 + 1) * xsize + ii1 + 1;
+                    w[0]   = (1.0 - uf) * (1.0 - tf);
+                    w[1]   = uf * (1.0 - tf);
+                    w[2]   = (1.0 - uf) * tf;
+                    w[3]   = uf * tf;
+                }
+            }
+    }
+    else if(strcmp(opname, "swapaxis") == 0)
+    {
+        sop->op          = STREAMOP_SWAPAXIS;
+        sop->xsizeout    = ysize;
+        sop->ysizeout    = xsize;
+        sop->nelementout = (uint64_t) xsize * ysize;
+        streamop_allocmap(sop, 1);
+        for(uint32_t ii = 0; ii < xsize; ii++)
+            for(uint32_t jj = 0; jj < ysize; jj++)
+            {
+                uint64_t pix = (uint64_t) ii * ysize + jj;
+
+                sop->index[pix]  = jj * xsize + ii;
+                sop->weight[pix] = 1.0;
+            }
+    }
+    else
+    {
+        PRINT_ERROR("unknown operator %s", opname);
+        return RETURN_FAILURE;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+// apply planned transform to one frame
+static void streamop_apply(STREAMOP *sop, const void *in, float *out)
+{
+    if(sop->op == STREAMOP_CONTRACT)
+    {
+        memset(sop->accum, 0, sizeof(double) * sop->nelementout);
+        basic_contract_frame_add(sop->accum,
+                                 in,
+                                 sop->datatype,
+                                 sop->xsize,
+                                 sop->ysize,
+                                 sop->n1,
+                                 sop->n2);
+        for(uint64_t ii = 0; ii < sop->nelementout; ii++)
+        {
+            out[ii] = sop->accum[ii];
+        }
+        return;
+    }
+
+#define STREAMOP_GATHER(type)                                                  \
+    {                                                                          \
+        const type *inptr = (const type *) in;                                 \
+        if(sop->NBterm == 1)                                                   \
+        {                                                                      \
+            for(uint64_t ii = 0; ii < sop->nelementout; ii++)                  \
+            {                                                                  \
+                uint32_t idx = sop->index[ii];                                 \
+                out[ii] = (idx == STREAMOP_NOPIX) ? 0.0 : inptr[idx];          \
+            }                                                                  \
+        }                                                                      \
+        else                                                                   \
+        {                                                                      \
+            for(uint64_t ii = 0; ii < sop->nelementout; ii++)                  \
+            {                                                                  \
+                const uint32_t *idx = sop->index + 4 * ii;                     \
+                const float    *w   = sop->weight + 4 * ii;                    \
+                if(idx[0] == STREAMOP_NOPIX)                                   \
+                {                                                              \
+                    out[ii] = 0.0;                                             \
+                    continue;                                                  \
+                }                                                              \
+                out[ii] = w[0] * inptr[idx[0]] + w[1] * inptr[idx[1]] +        \
+                          w[2] * inptr[idx[2]] + w[3] * inptr[idx[3]];         \
+            }                                                                  \
+        }                                                                      \
+    }                                                                          \
+    break;
+
+    switch(sop->datatype)
+    {
+        case _DATATYPE_UINT8:
+            STREAMOP_GATHER(uint8_t)
+        case _DATATYPE_INT8:
+            STREAMOP_GATHER(int8_t)
+        case _DATATYPE_UINT16:
+            STREAMOP_GATHER(uint16_t)
+        case _DATATYPE_INT16:
+            STREAMOP_GATHER(int16_t)
+        case _DATATYPE_UINT32:
+            STREAMOP_GATHER(uint32_t)
+        case _DATATYPE_INT32:
+            STREAMOP_GATHER(int32_t)
+        case _DATATYPE_UINT64:
+            STREAMOP_GATHER(uint64_t)
+        case _DATATYPE_INT64:
+            STREAMOP_GATHER(int64_t)
+        case _DATATYPE_FLOAT:
+            STREAMOP_GATHER(float)
+        case _DATATYPE_DOUBLE:
+            STREAMOP_GATHER(double)
+    }
+
+#undef STREAMOP_GATHER
+}
+
+// apply transform opname to frames of stream IDin_name, until NBframes are
+// processed (NBframes = 0 : until SIGINT/SIGTERM)
+//
+// Input stream can be of any real datatype (complex is rejected).
+// Output stream IDout_name is float, 2D. It is created if it does not
+// exist, an existing stream is used if its size and type match. The output
+// frame carries the acquisition time of the input frame, so latency along
+// a chain of operators can be read from the last stream.
+//
+// Operators and parameters :
+//   contract  p1 p2 : sum over p1 x p2 pixels (edge pixels are dropped)
+//   rotate    p1    : rotate by p1 [rad], nearest pixel
+//   resize    p1 p2 : bilinear resize to p1 x p2 pixels
+//   swapaxis        : transpose
+//
+// Compute time and input-write to output-post latency are reported on exit.
+//
+// returns number of frames processed
+long IMAGE_BASIC_streamop(const char *__restrict IDin_name,
+                          const char *__restrict IDout_name,
+                          const char *__restrict opname,
+                          float p1,
+                          float p2,
+                          long  NBframes)
+{
+    imageID                  IDin;
+    imageID                  IDout;
+    STREAMOP                 sop;
+    IMAGE_BASIC_STREAMREADER reader;
+    IMAGE_BASIC_JITTERHIST   comphist;
+    IMAGE_BASIC_JITTERHIST   lathist;
+    struct timespec          twrite;
+    struct timespec          twake;
+    struct timespec          tpost;
+    uint32_t                 naxesout[2];
+    long                     kk;
+
+    IDin = image_ID(IDin_name);
+
+    memset(&sop, 0, sizeof(STREAMOP));
+    sop.xsize    = data.image[IDin].md[0].size[0];
+    sop.ysize    = data.image[IDin].md[0].size[1];
+    sop.datatype = data.image[IDin].md[0].datatype;
+    if(data.image[IDin].md[0].naxis == 1)
+    {
+        sop.ysize = 1;
+    }
+    switch(sop.datatype)
+    {
+        case _DATATYPE_UINT8:
+        case _DATATYPE_INT8:
+        case _DATATYPE_UINT16:
+        case _DATATYPE_INT16:
+        case _DATATYPE_UINT32:
+        case _DATATYPE_INT32:
+        case _DATATYPE_UINT64:
+        case _DATATYPE_INT64:
+        case _DATATYPE_FLOAT:
+        case _DATATYPE_DOUBLE:
+            break;
+        default:
+            PRINT_ERROR("stream %s : datatype %d not supported",
+                        IDin_name,
+                        (int) sop.datatype);
+            return 0;
+    }
+    if(streamop_plan(&sop, opname, p1, p2) != RETURN_SUCCESS)
+    {
+        free(sop.accum);
+        free(sop.index);
+        free(sop.weight);
+        return 0;
+    }
+
+    naxesout[0] = sop.xsizeout;
+    naxesout[1] = sop.ysizeout;
+    IDout       = image_ID(IDout_name);
+    if(IDout == -1)
+    {
+        create_image_ID(IDout_name,
+                        2,
+                        naxesout,
+                        _DATATYPE_FLOAT,
+                        1,
+                        0,
+                        0,
+                        &IDout);
+    }
+    else if((data.image[IDout].md[0].datatype != _DATATYPE_FLOAT) ||
+            ((uint64_t) data.image[IDout].md[0].nelement != sop.nelementout))
+    {
+        PRINT_ERROR("stream %s exists, needs %u x %u float",
+                    IDout_name,
+                    sop.xsizeout,
+                    sop.ysizeout);
+        free(sop.accum);
+        free(sop.index);
+        free(sop.weight);
+        return 0;
+    }
+
+    printf("%s : %u x %u -> %s : %u x %u\n",
+           opname,
+           sop.xsize,
+           sop.ysize,
+           IDout_name,
+           sop.xsizeout,
+           sop.ysizeout);
+
+    image_basic_jitterhist_init(&comphist);
+    image_basic_jitterhist_init(&lathist);
+    image_basic_streamreader_init(&reader, IDin);
+
+    kk = 0;
+    while((NBframes == 0) || (kk < NBframes))
+    {
+        if(image_basic_streamreader_wait(&reader, 1000000) == 0)
+        {
+            if((data.signal_INT == 1) || (data.signal_TERM == 1))
+            {
+                break;
+            }
+            continue;
+        }
+        clock_gettime(CLOCK_REALTIME, &twake);
+        twrite = data.image[IDin].md[0].writetime;
+
+        data.image[IDout].md[0].write = 1;
+        streamop_apply(&sop,
+                       image_basic_streamreader_frame(&reader),
+                       data.image[IDout].array.F);
+        image_basic_streamreader_release(&reader);
+        data.image[IDout].md[0].atime = reader.atime;
+        clock_gettime(CLOCK_REALTIME, &tpost);
+        data.image[IDout].md[0].writetime = tpost;
+        data.image[IDout].md[0].write     = 0;
+        data.image[IDout].md[0].cnt0++;
+        COREMOD_MEMORY_image_set_sempost_byID(IDout, -1);
+
+        image_basic_jitterhist_add(
+            &comphist,
+            image_basic_timespec_diff_ns(&twake, &tpost));
+        image_basic_jitterhist_add(
+            &lathist,
+            image_basic_timespec_diff_ns(&twrite, &tpost));
+        kk++;
+
+        if(kk % 1000 == 0)
+        {
+            printf("\r%ld frames  [%lu]  missed %ld      ",
+                   kk,
+                   (unsigned long) reader.cnt0,
+                   reader.NBmissed);
+            fflush(stdout);
+        }
+
+        if((data.signal_INT == 1) || (data.signal_TERM == 1))
+        {
+            break;
+        }
+    }
+
+    printf("\n\n%ld frame(s) processed, %ld missed, %ld overwritten while "
+           "processing\n",
+           kk,
+           reader.NBmissed,
+           reader.NBtorn);
+    if(kk > 0)
+    {
+        image_basic_jitterhist_print(&comphist, "compute time");
+        image_basic_jitterhist_print(&lathist, "input write to output post");
+    }
+
+    free(sop.accum);
+    free(sop.index);
+    free(sop.weight);
+
+    return kk;
+}
@@ -0,0 +1,11 @@
+/** @file streamop.h
+ */
+
+errno_t __attribute__((cold)) streamop_addCLIcmd();
+
+long IMAGE_BASIC_streamop(const char *__restrict IDin_name,
+                          const char *__restrict IDout_name,
+                          const char *__restrict opname,
+                          float p1,
+                          float p2,
+                          long  NBframes);
@@ -0,0 +1,858 @@
+/** @file streamrecdisk.c
+ *
+ * Record stream to disk : frames are copied into one of two large buffers
+ * by the acquisition loop while a writer thread flushes the other one, so
+ * capture length is bounded by disk space instead of memory
+ *
+ * Integer frames can also be written losslessly compressed (rice format) :
+ * one RICE_1 tile per frame, compressed by a pool of worker threads into a
+ * tile-compressed FITS file (.fz)
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "CommandLineInterface/CLIcore.h"
+
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "streamfits.h"
+#include "streamrecord.h"
+
+// target size of each frame buffer [bytes]
+#define STREAMRECDISK_BUFSIZE (64L * 1024 * 1024)
+
+// alignment of frame buffers (page size)
+#define STREAMRECDISK_ALIGN 4096
+
+// default number of compression threads (rice format)
+#define STREAMRECDISK_RICE_NBTHREAD 4
+
+// table rows reserved per file, relative to uncompressed frame count
+#define STREAMRECDISK_RICE_MAXRATIO 8
+
+// heap offsets are 32-bit (1PB descriptors)
+#define STREAMRECDISK_RICE_MAXHEAP (2047L * 1024 * 1024)
+
+typedef struct
+{
+    // double buffer : filled by acquisition loop, flushed by writer thread
+    char           *buf[2];
+    double         *timing[2]; // cnt0, acquisition time, receive time
+    long            NBframe[2];
+    int             full[2]; // 1 if owned by writer thread
+    long            NBframebuf;
+    int             stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+
+    // output files
+    char     fileprefix[STRINGMAXLEN_FILENAME];
+    int      fitsmode;
+    uint8_t  datatype;
+    long     xsize;
+    long     ysize;
+    size_t   framesize;
+    long     NBframefilemax;
+    long     fileindex;
+    int      fd;
+    FILE    *fptiming;
+    long     NBframefile;
+    long     NBframewritten;
+    int      writeerror;
+
+    // tile compression (rice format)
+    int             ricemode;
+    int             NBthread;
+    pthread_t      *workers;
+    unsigned char  *tilebuf;  // one slot of tileslot bytes per frame
+    size_t          tileslot;
+    long           *tilesize; // compressed size of each frame of buffer
+    const char     *jobbuf;   // buffer being compressed
+    long            jobNBframe;
+    long            jobnext;
+    long            jobdone;
+    int             jobstop;
+    pthread_mutex_t jobmutex;
+    pthread_cond_t  jobcond;
+    pthread_cond_t  jobdonecond;
+    int32_t        *tiledesc; // heap descriptors of current file
+    long            heapsize;
+    long            heapsizemax;
+    long            maxtilesize;
+} STREAMRECDISK;
+
+// ==========================================
+// Forward declaration(s)
+// ==========================================
+
+long IMAGE_BASIC_streamrecord_disk(const char *__restrict streamname,
+                                   long NBframes,
+                                   const char *__restrict fileprefix,
+                                   long filesizeMB,
+                                   const char *__restrict format);
+
+// ==========================================
+// Command line interface wrapper function(s)
+// ==========================================
+
+static errno_t IMAGE_BASIC_streamrecord_disk_cli()
+{
+    if(0 + CLI_checkarg(1, 4) + CLI_checkarg(2, 2) + CLI_checkarg(3, 3) +
+            CLI_checkarg(4, 2) + CLI_checkarg(5, 3) ==
+            0)
+    {
+        IMAGE_BASIC_streamrecord_disk(data.cmdargtoken[1].val.string,
+                                      data.cmdargtoken[2].val.numl,
+                                      data.cmdargtoken[3].val.string,
+                                      data.cmdargtoken[4].val.numl,
+                                      data.cmdargtoken[5].val.string);
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+// ==========================================
+// Register CLI command(s)
+// ==========================================
+
+errno_t __attribute__((cold)) streamrecdisk_addCLIcmd()
+{
+
+    RegisterCLIcommand(
+        "imgstreamrecdisk",
+        __FILE__,
+        IMAGE_BASIC_streamrecord_disk_cli,
+        "record stream of images to disk",
+        "<stream> <# frames, 0 until interrupted> <file prefix> "
+        "<max file size [MB]> <format (fits/raw/rice[:NBthread])>",
+        "imgstreamrecdisk imstream 0 /data/imrec 4096 fits",
+        "long IMAGE_BASIC_streamrecord_disk(const char *streamname, long "
+        "NBframes, const char *fileprefix, long filesizeMB, const char "
+        "*format)");
+
+    return RETURN_SUCCESS;
+}
+
+static int recdisk_write(int fd, const char *buf, size_t size)
+{
+    while(size > 0)
+    {
+        ssize_t n = write(fd, buf, size);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+static int recdisk_openfile(STREAMRECDISK *rec)
+{
+    char fname[STRINGMAXLEN_FILENAME];
+    char tname[STRINGMAXLEN_FILENAME];
+    char header[IMAGE_BASIC_FITS_BLOCKSIZE];
+    long naxes[3];
+
+    // a truncated name would overwrite another file, refuse it
+    if((snprintf(fname,
+                 STRINGMAXLEN_FILENAME,
+                 "%s_%04ld.%s",
+                 rec->fileprefix,
+                 rec->fileindex,
+                 rec->ricemode ? "fz" : (rec->fitsmode ? "fits" : "raw")) >=
+            STRINGMAXLEN_FILENAME) ||
+            (snprintf(tname,
+                      STRINGMAXLEN_FILENAME,
+                      "%s_%04ld.txt",
+                      rec->fileprefix,
+                      rec->fileindex) >= STRINGMAXLEN_FILENAME))
+    {
+        PRINT_ERROR("file name too long for prefix %s", rec->fileprefix);
+        return -1;
+    }
+
+    // timing file is opened first so that an open data file always has one
+    rec->fptiming = fopen(tname, "w");
+    if(rec->fptiming == NULL)
+    {
+        PRINT_ERROR("cannot create file %s", tname);
+        return -1;
+    }
+    rec->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(rec->fd == -1)
+    {
+        PRINT_ERROR("cannot create file %s", fname);
+        fclose(rec->fptiming);
+        return -1;
+    }
+
+    if(rec->ricemode == 1)
+    {
+        // headers are updated when the file is closed, heap starts after
+        // the table rows reserved for NBframefilemax frames
+        image_basic_fits_emptyprimary(header);
+        if(recdisk_write(rec->fd, header, IMAGE_BASIC_FITS_BLOCKSIZE) != 0)
+        {
+            return -1;
+        }
+        image_basic_fits_riceheader(header,
+                                    rec->datatype,
+                                    rec->xsize,
+                                    rec->ysize,
+                                    0,
+                                    rec->NBframefilemax,
+                                    0,
+                                    0,
+                                    IMAGE_BASIC_FITS_RICE_BLOCKSIZE);
+        if(recdisk_write(rec->fd, header, IMAGE_BASIC_FITS_BLOCKSIZE) != 0)
+        {
+            return -1;
+        }
+        if(lseek(rec->fd,
+                 2 * IMAGE_BASIC_FITS_BLOCKSIZE + 8 * rec->NBframefilemax,
+                 SEEK_SET) == -1)
+        {
+            return -1;
+        }
+        rec->heapsize    = 0;
+        rec->maxtilesize = 0;
+    }
+    else if(rec->fitsmode == 1)
+    {
+        // NAXIS3 is updated when the file is closed
+        naxes[0] = rec->xsize;
+        naxes[1] = rec->ysize;
+        naxes[2] = 0;
+        image_basic_fits_imageheader(header, rec->datatype, 3, naxes);
+        if(recdisk_write(rec->fd, header, IMAGE_BASIC_FITS_BLOCKSIZE) != 0)
+        {
+            return -1;
+        }
+    }
+
+    fprintf(rec->fptiming,
+            "# %ld x %ld frames, datatype %d\n",
+            rec->xsize,
+            rec->ysize,
+            (int) rec->datatype);
+    fprintf(rec->fptiming, "# frame  cnt0  acqtime  rectime\n");
+
+    rec->NBframefile = 0;
+
+    return 0;
+}
+
+static int recdisk_closefile(STREAMRECDISK *rec)
+{
+    char   header[IMAGE_BASIC_FITS_BLOCKSIZE];
+    long   naxes[3];
+    size_t padsize;
+
+    if(rec->ricemode == 1)
+    {
+        // pad heap to FITS block size, then write table and final header
+        padsize = (8 * rec->NBframefilemax + rec->heapsize) %
+                  IMAGE_BASIC_FITS_BLOCKSIZE;
+        if(padsize > 0)
+        {
+            padsize = IMAGE_BASIC_FITS_BLOCKSIZE - padsize;
+            memset(header, 0, padsize);
+            recdisk_write(rec->fd, header, padsize);
+        }
+
+        image_basic_fits_swap(rec->tiledesc,
+                              2 * rec->NBframefile,
+                              _DATATYPE_INT32);
+        if(pwrite(rec->fd,
+                  rec->tiledesc,
+                  8 * rec->NBframefile,
+                  2 * IMAGE_BASIC_FITS_BLOCKSIZE) != 8 * rec->NBframefile)
+        {
+            PRINT_ERROR("pwrite error");
+        }
+
+        image_basic_fits_riceheader(header,
+                                    rec->datatype,
+                                    rec->xsize,
+                                    rec->ysize,
+                                    rec->NBframefile,
+                                    rec->NBframefilemax,
+                                    rec->heapsize,
+                                    rec->maxtilesize,
+                                    IMAGE_BASIC_FITS_RICE_BLOCKSIZE);
+        if(pwrite(rec->fd,
+                  header,
+                  IMAGE_BASIC_FITS_BLOCKSIZE,
+                  IMAGE_BASIC_FITS_BLOCKSIZE) != IMAGE_BASIC_FITS_BLOCKSIZE)
+        {
+            PRINT_ERROR("pwrite error");
+        }
+    }
+    else if(rec->fitsmode == 1)
+    {
+        // pad data unit to FITS block size, then write final header
+        padsize = (rec->NBframefile * rec->framesize) %
+                  IMAGE_BASIC_FITS_BLOCKSIZE;
+        if(padsize > 0)
+        {
+            padsize = IMAGE_BASIC_FITS_BLOCKSIZE - padsize;
+            memset(header, 0, padsize);
+            recdisk_write(rec->fd, header, padsize);
+        }
+
+        naxes[0] = rec->xsize;
+        naxes[1] = rec->ysize;
+        naxes[2] = rec->NBframefile;
+        image_basic_fits_imageheader(header, rec->datatype, 3, naxes);
+        if(pwrite(rec->fd, header, IMAGE_BASIC_FITS_BLOCKSIZE, 0) !=
+                IMAGE_BASIC_FITS_BLOCKSIZE)
+        {
+            PRINT_ERROR("pwrite error");
+        }
+    }
+
+    close(rec->fd);
+    fclose(rec->fptiming);
+    rec->fd = -1;
+
+    printf("\n  file %s_%04ld : %ld frames\n",
+           rec->fileprefix,
+           rec->fileindex,
+           rec->NBframefile);
+    if((rec->ricemode == 1) && (rec->heapsize > 0))
+    {
+        printf("  compression ratio %.2f\n",
+               (double) rec->NBframefile * rec->framesize / rec->heapsize);
+    }
+    rec->fileindex++;
+
+    return 0;
+}
+
+static void recdisk_writetiming(STREAMRECDISK *rec, const double *tptr, long n)
+{
+    for(long frame = 0; frame < n; frame++)
+    {
+        fprintf(rec->fptiming,
+                "%8ld %10lu %20.9f %20.9f\n",
+                rec->NBframefile + frame,
+                (unsigned long) tptr[3 * frame],
+                tptr[3 * frame + 1],
+                tptr[3 * frame + 2]);
+    }
+}
+
+// compression worker : takes frames of the current job one at a time
+static void *recdisk_compressor(void *ptr)
+{
+    STREAMRECDISK *rec = (STREAMRECDISK *) ptr;
+    uint64_t       nelement = (uint64_t) rec->xsize * rec->ysize;
+
+    pthread_mutex_lock(&rec->jobmutex);
+    while(1)
+    {
+        long frame;
+
+        while((rec->jobnext >= rec->jobNBframe) && (rec->jobstop == 0))
+        {
+            pthread_cond_wait(&rec->jobcond, &rec->jobmutex);
+        }
+        if(rec->jobnext >= rec->jobNBframe)
+        {
+            break;
+        }
+        frame = rec->jobnext;
+        rec->jobnext++;
+        pthread_mutex_unlock(&rec->jobmutex);
+
+        rec->tilesize[frame] =
+            image_basic_fits_ricecomp(rec->jobbuf + frame * rec->framesize,
+                                      nelement,
+                                      rec->datatype,
+                                      rec->tilebuf + frame * rec->tileslot,
+                                      rec->tileslot,
+                                      IMAGE_BASIC_FITS_RICE_BLOCKSIZE);
+
+        pthread_mutex_lock(&rec->jobmutex);
+        rec->jobdone++;
+        if(rec->jobdone == rec->jobNBframe)
+        {
+            pthread_cond_signal(&rec->jobdonecond);
+        }
+    }
+    pthread_mutex_unlock(&rec->jobmutex);
+
+    return NULL;
+}
+
+// compress buffer b on worker threads, then append tiles to heap
+static int recdisk_writebuffer_rice(STREAMRECDISK *rec, int b)
+{
+    double *tptr    = rec->timing[b];
+    long    NBframe = rec->NBframe[b];
+
+    pthread_mutex_lock(&rec->jobmutex);
+    rec->jobbuf     = rec->buf[b];
+    rec->jobNBframe = NBframe;
+    rec->jobnext    = 0;
+    rec->jobdone    = 0;
+    pthread_cond_broadcast(&rec->jobcond);
+    while(rec->jobdone < rec->jobNBframe)
+    {
+        pthread_cond_wait(&rec->jobdonecond, &rec->jobmutex);
+    }
+    pthread_mutex_unlock(&rec->jobmutex);
+
+    for(long frame = 0; frame < NBframe; frame++)
+    {
+        long tilesize = rec->tilesize[frame];
+
+        if(tilesize < 0)
+        {
+            PRINT_ERROR("compression error");
+            return -1;
+        }
+
+        if((rec->fd != -1) && (rec->heapsize + tilesize > rec->heapsizemax))
+        {
+            recdisk_closefile(rec);
+        }
+        if(rec->fd == -1)
+        {
+            if(recdisk_openfile(rec) != 0)
+            {
+                return -1;
+            }
+        }
+
+        if(recdisk_write(rec->fd,
+                         (char *) rec->tilebuf + frame * rec->tileslot,
+                         tilesize) != 0)
+        {
+            PRINT_ERROR("write error");
+            return -1;
+        }
+        rec->tiledesc[2 * rec->NBframefile]     = tilesize;
+        rec->tiledesc[2 * rec->NBframefile + 1] = rec->heapsize;
+        rec->heapsize += tilesize;
+        if(tilesize > rec->maxtilesize)
+        {
+            rec->maxtilesize = tilesize;
+        }
+        recdisk_writetiming(rec, tptr + 3 * frame, 1);
+
+        rec->NBframefile++;
+        rec->NBframewritten++;
+
+        if(rec->NBframefile == rec->NBframefilemax)
+        {
+            recdisk_closefile(rec);
+        }
+    }
+
+    return 0;
+}
+
+// write buffer b, rolling over to a new file when size limit is reached
+static int recdisk_writebuffer(STREAMRECDISK *rec, int b)
+{
+    char   *ptr     = rec->buf[b];
+    double *tptr    = rec->timing[b];
+    long    NBframe = rec->NBframe[b];
+
+    if(rec->ricemode == 1)
+    {
+        return recdisk_writebuffer_rice(rec, b);
+    }
+
+    if(rec->fitsmode == 1)
+    {
+        image_basic_fits_swap(ptr,
+                              (uint64_t) NBframe * rec->xsize * rec->ysize,
+                              rec->datatype);
+    }
+
+    while(NBframe > 0)
+    {
+        long n;
+
+        if(rec->fd == -1)
+        {
+            if(recdisk_openfile(rec) != 0)
+            {
+                return -1;
+            }
+        }
+
+        n = rec->NBframefilemax - rec->NBframefile;
+        if(n > NBframe)
+        {
+            n = NBframe;
+        }
+        if(recdisk_write(rec->fd, ptr, n * rec->framesize) != 0)
+        {
+            PRINT_ERROR("write error");
+            return -1;
+        }
+        recdisk_writetiming(rec, tptr, n);
+
+        ptr += n * rec->framesize;
+        tptr += 3 * n;
+        NBframe -= n;
+        rec->NBframefile += n;
+        rec->NBframewritten += n;
+
+        if(rec->NBframefile == rec->NBframefilemax)
+        {
+            recdisk_closefile(rec);
+        }
+    }
+
+    return 0;
+}
+
+static void *recdisk_writer(void *ptr)
+{
+    STREAMRECDISK *rec = (STREAMRECDISK *) ptr;
+    int            b   = 0;
+
+    pthread_mutex_lock(&rec->mutex);
+    while(1)
+    {
+        while((rec->full[b] == 0) && (rec->stop == 0))
+        {
+            pthread_cond_wait(&rec->cond, &rec->mutex);
+        }
+        if(rec->full[b] == 0)
+        {
+            break;
+        }
+        pthread_mutex_unlock(&rec->mutex);
+
+        if((rec->writeerror == 0) && (recdisk_writebuffer(rec, b) != 0))
+        {
+            rec->writeerror = 1;
+        }
+
+        pthread_mutex_lock(&rec->mutex);
+        rec->full[b] = 0;
+        b            = 1 - b;
+    }
+    pthread_mutex_unlock(&rec->mutex);
+
+    if(rec->fd != -1)
+    {
+        recdisk_closefile(rec);
+    }
+
+    return NULL;
+}
+
+// record stream frames to disk, until NBframes are recorded
+// (NBframes = 0 : until SIGINT/SIGTERM)
+//
+// Frames go to files <fileprefix>_NNNN.fits (or .raw), each holding up to
+// filesizeMB. Per-frame cnt0 and timing is written to <fileprefix>_NNNN.txt.
+//
+// format rice[:NBthread] writes 8, 16 or 32 bit integer frames to
+// tile-compressed FITS files <fileprefix>_NNNN.fz (one RICE_1 tile per
+// frame, readable with funpack or CFITSIO), compressed by NBthread worker
+// threads (default 4). filesizeMB then bounds the compressed size.
+// If the writer thread falls behind by more than one buffer, incoming
+// frames are dropped and counted, the acquisition loop never waits on I/O.
+//
+// returns number of frames written
+long IMAGE_BASIC_streamrecord_disk(const char *__restrict streamname,
+                                   long NBframes,
+                                   const char *__restrict fileprefix,
+                                   long filesizeMB,
+                                   const char *__restrict format)
+{
+    imageID                  IDstream;
+    IMAGE_BASIC_STREAMREADER reader;
+    STREAMRECDISK            rec;
+    pthread_t                writer_thread;
+    struct timespec          ts;
+    double                   bzero;
+    long                     kk;
+    long                     NBdropped = 0;
+    long                     n;
+    int                      b;
+    int                      buffull;
+
+    IDstream = image_ID(streamname);
+
+    memset(&rec, 0, sizeof(STREAMRECDISK));
+    strncpy(rec.fileprefix, fileprefix, STRINGMAXLEN_FILENAME - 1);
+    if(strcmp(format, "fits") == 0)
+    {
+        rec.fitsmode = 1;
+    }
+    else if(strcmp(format, "raw") == 0)
+    {
+        rec.fitsmode = 0;
+    }
+    else if((strcmp(format, "rice") == 0) || (strncmp(format, "rice:", 5) == 0))
+    {
+        char *endptr = NULL;
+
+        rec.fitsmode = 1;
+        rec.ricemode = 1;
+        rec.NBthread = STREAMRECDISK_RICE_NBTHREAD;
+        if(format[4] == ':')
+        {
+            rec.NBthread = strtol(format + 5, &endptr, 10);
+            if((endptr == format + 5) || (*endptr != '\0') ||
+                    (rec.NBthread < 1))
+            {
+                PRINT_ERROR("invalid thread count in format %s", format);
+                return -1;
+            }
+        }
+    }
+    else
+    {
+        PRINT_ERROR("unknown format %s (fits, raw or rice[:NBthread])",
+                    format);
+        return -1;
+    }
+    rec.datatype = data.image[IDstream].md[0].datatype;
+    rec.xsize    = data.image[IDstream].md[0].size[0];
+    rec.ysize    = data.image[IDstream].md[0].size[1];
+    rec.fd       = -1;
+
+    if((rec.fitsmode == 1) &&
+            (image_basic_fits_bitpix(rec.datatype, &bzero) == 0))
+    {
+        PRINT_ERROR("datatype cannot be written to FITS, use raw format");
+        return -1;
+    }
+    if(rec.ricemode == 1)
+    {
+        int bitpix = image_basic_fits_bitpix(rec.datatype, &bzero);
+
+        if((bitpix != 8) && (bitpix != 16) && (bitpix != 32))
+        {
+            PRINT_ERROR("rice format requires 8, 16 or 32 bit integer "
+                        "frames");
+            return -1;
+        }
+    }
+
+    image_basic_streamreader_init(&reader, IDstream);
+    rec.framesize = reader.framesize;
+
+    rec.NBframebuf = STREAMRECDISK_BUFSIZE / rec.framesize;
+    if(rec.NBframebuf < 1)
+    {
+        rec.NBframebuf = 1;
+    }
+    rec.NBframefilemax = (filesizeMB * 1024 * 1024) / rec.framesize;
+    if(rec.ricemode == 1)
+    {
+        // file size limit applies to heap, reserve table rows for
+        // compression ratios up to STREAMRECDISK_RICE_MAXRATIO
+        rec.heapsizemax = filesizeMB * 1024 * 1024;
+        if(rec.heapsizemax > STREAMRECDISK_RICE_MAXHEAP)
+        {
+            rec.heapsizemax = STREAMRECDISK_RICE_MAXHEAP;
+        }
+        rec.NBframefilemax =
+            rec.heapsizemax / rec.framesize * STREAMRECDISK_RICE_MAXRATIO;
+    }
+    if(rec.NBframefilemax < 1)
+    {
+        rec.NBframefilemax = 1;
+    }
+
+    for(b = 0; b < 2; b++)
+    {
+        size_t bufsize = rec.NBframebuf * rec.framesize;
+
+        // whole number of pages
+        bufsize = (bufsize + STREAMRECDISK_ALIGN - 1) / STREAMRECDISK_ALIGN *
+                  STREAMRECDISK_ALIGN;
+        if(posix_memalign((void **) &rec.buf[b],
+                          STREAMRECDISK_ALIGN,
+                          bufsize) != 0)
+        {
+            PRINT_ERROR("posix_memalign error");
+            abort();
+        }
+        rec.timing[b] =
+            (double *) malloc(sizeof(double) * 3 * rec.NBframebuf);
+        if(rec.timing[b] == NULL)
+        {
+            PRINT_ERROR("malloc returns NULL pointer");
+            abort();
+        }
+    }
+
+    if(rec.ricemode == 1)
+    {
+        // worst case RICE_1 expansion is below 1/16 for 32-pixel blocks
+        rec.tileslot = rec.framesize + rec.framesize / 16 + 64;
+        rec.tilebuf =
+            (unsigned char *) malloc(rec.tileslot * rec.NBframebuf);
+        rec.tilesize = (long *) malloc(sizeof(long) * rec.NBframebuf);
+        rec.tiledesc =
+            (int32_t *) malloc(sizeof(int32_t) * 2 * rec.NBframefilemax);
+        rec.workers =
+            (pthread_t *) malloc(sizeof(pthread_t) * rec.NBthread);
+        if((rec.tilebuf == NULL) || (rec.tilesize == NULL) ||
+                (rec.tiledesc == NULL) || (rec.workers == NULL))
+        {
+            PRINT_ERROR("malloc returns NULL pointer");
+            abort();
+        }
+
+        pthread_mutex_init(&rec.jobmutex, NULL);
+        pthread_cond_init(&rec.jobcond, NULL);
+        pthread_cond_init(&rec.jobdonecond, NULL);
+        for(int t = 0; t < rec.NBthread; t++)
+        {
+            pthread_create(&rec.workers[t], NULL, recdisk_compressor, &rec);
+        }
+        printf("rice compression : %d thread(s)\n", rec.NBthread);
+    }
+
+    printf("buffer : 2 x %ld frames, up to %ld frames per file\n",
+           rec.NBframebuf,
+           rec.NBframefilemax);
+
+    pthread_mutex_init(&rec.mutex, NULL);
+    pthread_cond_init(&rec.cond, NULL);
+    pthread_create(&writer_thread, NULL, recdisk_writer, &rec);
+
+    kk = 0;
+    b  = 0;
+    n  = 0;
+    while((NBframes == 0) || (kk < NBframes))
+    {
+        if(image_basic_streamreader_wait(&reader, 1000000) == 0)
+        {
+            if((data.signal_INT == 1) || (data.signal_TERM == 1))
+            {
+                break;
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&rec.mutex);
+        buffull = rec.full[b];
+        pthread_mutex_unlock(&rec.mutex);
+        if(buffull == 1)
+        {
+            // writer thread has not released this buffer yet
+            NBdropped++;
+            continue;
+        }
+
+        image_basic_streamreader_copy(&reader,
+                                      rec.buf[b] + n * rec.framesize);
+        clock_gettime(CLOCK_REALTIME, &ts);
+        rec.timing[b][3 * n]     = reader.cnt0;
+        rec.timing[b][3 * n + 1] =
+            reader.atime.tv_sec + 1.0e-9 * reader.atime.tv_nsec;
+        rec.timing[b][3 * n + 2] = ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+        n++;
+        kk++;
+
+        if(n == rec.NBframebuf)
+        {
+            pthread_mutex_lock(&rec.mutex);
+            rec.NBframe[b] = n;
+            rec.full[b]    = 1;
+            pthread_cond_signal(&rec.cond);
+            pthread_mutex_unlock(&rec.mutex);
+            b = 1 - b;
+            n = 0;
+        }
+
+        if(kk % 1000 == 0)
+        {
+            printf("\r%ld frames  [%lu]  missed %ld  dropped %ld      ",
+                   kk,
+                   (unsigned long) reader.cnt0,
+                   reader.NBmissed,
+                   NBdropped);
+            fflush(stdout);
+        }
+
+        if((data.signal_INT == 1) || (data.signal_TERM == 1))
+        {
+            break;
+        }
+    }
+
+    // flush partial buffer and stop writer
+    pthread_mutex_lock(&rec.mutex);
+    if(n > 0)
+    {
+        while(rec.full[b] == 1)
+        {
+            pthread_mutex_unlock(&rec.mutex);
+            usleep(1000);
+            pthread_mutex_lock(&rec.mutex);
+        }
+        rec.NBframe[b] = n;
+        rec.full[b]    = 1;
+    }
+    rec.stop = 1;
+    pthread_cond_signal(&rec.cond);
+    pthread_mutex_unlock(&rec.mutex);
+    pthread_join(writer_thread, NULL);
+
+    printf("\n\n");
+    image_basic_streamreader_report(&reader,
+                                    rec.NBframewritten,
+                                    kk + NBdropped);
+    if(NBdropped > 0)
+    {
+        printf("%ld frame(s) dropped : disk writes too slow\n", NBdropped);
+    }
+    if(rec.writeerror == 1)
+    {
+        printf("ERROR: write error, recording incomplete\n");
+    }
+
+    pthread_mutex_destroy(&rec.mutex);
+    pthread_cond_destroy(&rec.cond);
+    if(rec.ricemode == 1)
+    {
+        pthread_mutex_lock(&rec.jobmutex);
+        rec.jobstop = 1;
+        pthread_cond_broadcast(&rec.jobcond);
+        pthread_mutex_unlock(&rec.jobmutex);
+        for(int t = 0; t < rec.NBthread; t++)
+        {
+            pthread_join(rec.workers[t], NULL);
+        }
+        pthread_mutex_destroy(&rec.jobmutex);
+        pthread_cond_destroy(&rec.jobcond);
+        pthread_cond_destroy(&rec.jobdonecond);
+        free(rec.workers);
+        free(rec.tilebuf);
+        free(rec.tilesize);
+        free(rec.tiledesc);
+    }
+    for(b = 0; b < 2; b++)
+    {
+        free(rec.buf[b]);
+        free(rec.timing[b]);
+    }
+
+    return rec.NBframewritten;
+}
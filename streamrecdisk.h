@@ -0,0 +1,10 @@
+/** @file streamrecdisk.h
+ */
+
+errno_t __attribute__((cold)) streamrecdisk_addCLIcmd();
+
+long IMAGE_BASIC_streamrecord_disk(const char *__restrict streamname,
+                                   long NBframes,
+                                   const char *__restrict fileprefix,
+                                   long filesizeMB,
+                                   const char *__restrict format);
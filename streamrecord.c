@@ -1,12 +1,25 @@
 /** @file streamrecord.c
  */
 
+#include <pthread.h>
 #include <sched.h>
+#include <signal.h>
 
 #include "CommandLineInterface/CLIcore.h"
 
 #include "COREMOD_memory/COREMOD_memory.h"
 
+#include "imcontract.h"
+#include "streamrecord.h"
+
+// max number of streams recorded by IMAGE_BASIC_streamrecord_multi()
+#define STREAMRECORD_MULTI_MAXSTREAM 16
+
+// binning and coadd settings, see IMAGE_BASIC_streamrecord_setbinning()
+static int  streamrecord_binx    = 1;
+static int  streamrecord_biny    = 1;
+static long streamrecord_NBcoadd = 1;
+
 // ==========================================
 // Forward declaration(s)
 // ==========================================
@@ -15,6 +28,20 @@ imageID IMAGE_BASIC_streamrecord(const char *__restrict streamname,
                                  long NBframes,
                                  const char *__restrict IDname);
 
+imageID IMAGE_BASIC_streamrecord_trigger(const char *__restrict streamname,
+        long NBpre,
+        long NBpost,
+        const char *__restrict IDname,
+        const char *__restrict trigger);
+
+errno_t IMAGE_BASIC_streamrecord_sendtrigger(long pid);
+
+errno_t IMAGE_BASIC_streamrecord_setbinning(int binx, int biny, long NBcoadd);
+
+imageID IMAGE_BASIC_streamrecord_multi(const char *__restrict streamnames,
+                                       long NBframes,
+                                       const char *__restrict IDprefix);
+
 // ==========================================
 // Command line interface wrapper function(s)
 // ==========================================
@@ -34,6 +61,68 @@ static errno_t IMAGE_BASIC_streamrecord_cli()
     }
 }
 
+static errno_t IMAGE_BASIC_streamrecord_trigger_cli()
+{
+    if(0 + CLI_checkarg(1, 4) + CLI_checkarg(2, 2) + CLI_checkarg(3, 2) +
+            CLI_checkarg(4, 3) + CLI_checkarg(5, 5) ==
+            0)
+    {
+        IMAGE_BASIC_streamrecord_trigger(data.cmdargtoken[1].val.string,
+                                         data.cmdargtoken[2].val.numl,
+                                         data.cmdargtoken[3].val.numl,
+                                         data.cmdargtoken[4].val.string,
+                                         data.cmdargtoken[5].val.string);
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+static errno_t IMAGE_BASIC_streamrecord_sendtrigger_cli()
+{
+    if(0 + CLI_checkarg(1, 2) == 0)
+    {
+        IMAGE_BASIC_streamrecord_sendtrigger(data.cmdargtoken[1].val.numl);
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+static errno_t IMAGE_BASIC_streamrecord_setbinning_cli()
+{
+    if(0 + CLI_checkarg(1, 2) + CLI_checkarg(2, 2) + CLI_checkarg(3, 2) == 0)
+    {
+        IMAGE_BASIC_streamrecord_setbinning(data.cmdargtoken[1].val.numl,
+                                            data.cmdargtoken[2].val.numl,
+                                            data.cmdargtoken[3].val.numl);
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
+static errno_t IMAGE_BASIC_streamrecord_multi_cli()
+{
+    if(0 + CLI_checkarg(1, 5) + CLI_checkarg(2, 2) + CLI_checkarg(3, 3) == 0)
+    {
+        IMAGE_BASIC_streamrecord_multi(data.cmdargtoken[1].val.string,
+                                       data.cmdargtoken[2].val.numl,
+                                       data.cmdargtoken[3].val.string);
+        return CLICMD_SUCCESS;
+    }
+    else
+    {
+        return CLICMD_INVALID_ARG;
+    }
+}
+
 // ==========================================
 // Register CLI command(s)
 // ==========================================
@@ -50,56 +139,970 @@ errno_t __attribute__((cold)) streamrecord_addCLIcmd()
                        "long IMAGE_BASIC_streamrecord(const char *streamname, "
                        "long NBframes, const char *IDname)");
 
+    RegisterCLIcommand(
+        "imgstreamrectrig",
+        __FILE__,
+        IMAGE_BASIC_streamrecord_trigger_cli,
+        "record stream frames around a trigger",
+        "<stream> <# pre-trigger frames> <# post-trigger frames> <output> "
+        "<trigger (cmd, thr:<value>, cnt:<stream>)>",
+        "imgstreamrectrig imstream 1000 200 imrec thr:60000",
+        "long IMAGE_BASIC_streamrecord_trigger(const char *streamname, long "
+        "NBpre, long NBpost, const char *IDname, const char *trigger)");
+
+    RegisterCLIcommand("imgstreamrecsendtrig",
+                       __FILE__,
+                       IMAGE_BASIC_streamrecord_sendtrigger_cli,
+                       "send trigger to imgstreamrectrig process",
+                       "<pid>",
+                       "imgstreamrecsendtrig 12345",
+                       "errno_t IMAGE_BASIC_streamrecord_sendtrigger(long "
+                       "pid)");
+
+    RegisterCLIcommand("imgstreamrecbin",
+                       __FILE__,
+                       IMAGE_BASIC_streamrecord_setbinning_cli,
+                       "set imgstreamrec binning and coadd",
+                       "<binx> <biny> <# frames coadded>",
+                       "imgstreamrecbin 4 4 10",
+                       "errno_t IMAGE_BASIC_streamrecord_setbinning(int "
+                       "binx, int biny, long NBcoadd)");
+
+    RegisterCLIcommand(
+        "imgstreamrecmulti",
+        __FILE__,
+        IMAGE_BASIC_streamrecord_multi_cli,
+        "record several streams on a common time base",
+        "<stream1,stream2,...> <# frames> <output prefix>",
+        "imgstreamrecmulti wfs,dmcmd,scicam 10000 rec",
+        "long IMAGE_BASIC_streamrecord_multi(const char *streamnames, long "
+        "NBframes, const char *IDprefix)");
+
     return RETURN_SUCCESS;
 }
 
-// works only for floats
+// ==========================================
+// Stream reader, shared by the record functions
+// ==========================================
+
+/* set up reader on stream IDstream
+ * waits on one of the stream semaphores, polls cnt0 if the stream has none
+ */
+errno_t image_basic_streamreader_init(IMAGE_BASIC_STREAMREADER *reader,
+                                      imageID IDstream)
+{
+    reader->IDstream  = IDstream;
+    reader->framesize = (size_t) ImageStreamIO_typesize(
+                            data.image[IDstream].md[0].datatype) *
+                        data.image[IDstream].md[0].size[0] *
+                        data.image[IDstream].md[0].size[1];
+    reader->NBmissed = 0;
+    reader->NBtorn   = 0;
+
+    reader->semindex = -1;
+    if(data.image[IDstream].md[0].sem > 0)
+    {
+        reader->semindex =
+            ImageStreamIO_getsemwaitindex(&data.image[IDstream], 0);
+        ImageStreamIO_semflush(&data.image[IDstream], reader->semindex);
+    }
+    reader->cnt0 = data.image[IDstream].md[0].cnt0;
+
+    return RETURN_SUCCESS;
+}
+
+/* wait for next stream frame, up to timeout_us
+ * returns 1 if a new frame is available, 0 on timeout
+ * frames skipped since the previous call are added to NBmissed
+ */
+int image_basic_streamreader_wait(IMAGE_BASIC_STREAMREADER *reader,
+                                  long timeout_us)
+{
+    IMAGE          *image       = &data.image[reader->IDstream];
+    long            waitdelayus = 50;
+    long            waittime_us = 0;
+    uint64_t        cnt0;
+    struct timespec ts;
+
+    if(reader->semindex == -1)
+    {
+        while(image->md[0].cnt0 == reader->cnt0)
+        {
+            if(waittime_us > timeout_us)
+            {
+                return 0;
+            }
+            usleep(waitdelayus);
+            waittime_us += waitdelayus;
+        }
+    }
+    else
+    {
+        do
+        {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += timeout_us / 1000000;
+            ts.tv_nsec += 1000 * (timeout_us % 1000000);
+            if(ts.tv_nsec >= 1000000000)
+            {
+                ts.tv_nsec -= 1000000000;
+                ts.tv_sec++;
+            }
+            if(sem_timedwait(image->semptr[reader->semindex], &ts) != 0)
+            {
+                // unrelated signals do not end the wait
+                if((errno == EINTR) && (data.signal_INT == 0) &&
+                        (data.signal_TERM == 0))
+                {
+                    continue;
+                }
+                return 0;
+            }
+            // extra semaphore posts for an already read frame are skipped
+        }
+        while(image->md[0].cnt0 == reader->cnt0);
+    }
+
+    cnt0 = image->md[0].cnt0;
+    if(cnt0 - reader->cnt0 > 1)
+    {
+        reader->NBmissed += cnt0 - reader->cnt0 - 1;
+    }
+    reader->cnt0 = cnt0;
+
+    return 1;
+}
+
+/* pointer to the frame announced by last wait
+ * circular buffer streams (3D) : last written slice is cnt1
+ */
+const void *image_basic_streamreader_frame(IMAGE_BASIC_STREAMREADER *reader)
+{
+    IMAGE *image = &data.image[reader->IDstream];
+    char  *ptr   = (char *) image->array.raw;
+
+    reader->atime = image->md[0].atime;
+    if(image->md[0].naxis == 3)
+    {
+        ptr += reader->framesize * image->md[0].cnt1;
+    }
+
+    return ptr;
+}
+
+/* call when done reading the frame
+ * returns 1 and increments NBtorn if the stream was updated meanwhile
+ */
+int image_basic_streamreader_release(IMAGE_BASIC_STREAMREADER *reader)
+{
+    if(data.image[reader->IDstream].md[0].cnt0 != reader->cnt0)
+    {
+        reader->NBtorn++;
+        return 1;
+    }
+
+    return 0;
+}
+
+void image_basic_streamreader_copy(IMAGE_BASIC_STREAMREADER *reader,
+                                   void *dest)
+{
+    memcpy(dest, image_basic_streamreader_frame(reader), reader->framesize);
+    image_basic_streamreader_release(reader);
+}
+
+// print loss statistics at end of recording
+void image_basic_streamreader_report(const IMAGE_BASIC_STREAMREADER *reader,
+                                     long NBframes,
+                                     long NBframes_requested)
+{
+    printf("%ld frame(s) recorded, %ld missed, "
+           "%ld overwritten while copying\n",
+           NBframes,
+           reader->NBmissed,
+           reader->NBtorn);
+    if((reader->NBmissed == 0) && (reader->NBtorn == 0) &&
+            (NBframes == NBframes_requested))
+    {
+        printf("no frame lost\n");
+    }
+}
+
+/* set binning applied by next IMAGE_BASIC_streamrecord call
+ *
+ * binx, biny : spatial binning, as basic_contract (sum over bins, edge
+ *              pixels not filling a full bin are dropped)
+ * NBcoadd    : number of consecutive frames summed into each output frame
+ *
+ * 1 1 1 records raw frames. Any other setting records float frames.
+ */
+errno_t IMAGE_BASIC_streamrecord_setbinning(int binx, int biny, long NBcoadd)
+{
+    if((binx < 1) || (biny < 1) || (NBcoadd < 1))
+    {
+        PRINT_ERROR("binning and coadd factors must be >= 1");
+        return RETURN_FAILURE;
+    }
+    streamrecord_binx    = binx;
+    streamrecord_biny    = biny;
+    streamrecord_NBcoadd = NBcoadd;
+
+    printf("streamrecord binning %d x %d, %ld frame(s) coadded\n",
+           streamrecord_binx,
+           streamrecord_biny,
+           streamrecord_NBcoadd);
+
+    return RETURN_SUCCESS;
+}
+
+// record NBframes consecutive frames of stream into 3D image IDname
+//
+// The function waits on one of the stream semaphores (polls cnt0 if the
+// stream has none). Skipped frames are detected from cnt0 increments and
+// reported at the end. A per-frame table is written to image
+// <IDname>_timing, size 3 x NBframes (double) :
+//   cnt0, stream acquisition time [s], time written to IDname [s]
+//
+// If binning or coadd is set (imgstreamrecbin), frames are binned and
+// summed on the fly and NBframes float output frames are recorded. Timing
+// rows then hold cnt0 and acquisition time of the first coadded frame.
 //
 imageID IMAGE_BASIC_streamrecord(const char *__restrict streamname,
                                  long NBframes,
                                  const char *__restrict IDname)
 {
-    imageID       ID;
-    imageID       IDstream;
-    long          xsize, ysize, zsize, xysize;
-    unsigned long cnt;
-    long          waitdelayus = 50;
-    long          kk;
-    char         *ptr;
+    imageID                  ID;
+    imageID                  IDtiming;
+    imageID                  IDstream;
+    uint32_t                 naxes[3];
+    char                     IDtiming_name[STRINGMAXLEN_IMGNAME];
+    IMAGE_BASIC_STREAMREADER reader;
+    struct timespec          ts;
+    long                     kk;
+    char                    *ptr;
+    int                      binmode;
+    uint8_t                  datatype;
+    uint64_t                 nelementout;
+    double                  *coadd = NULL;
+    long                     NBcoadded;
 
     IDstream = image_ID(streamname);
-    xsize    = data.image[IDstream].md[0].size[0];
-    ysize    = data.image[IDstream].md[0].size[1];
-    zsize    = NBframes;
-    xysize   = xsize * ysize;
+    datatype = data.image[IDstream].md[0].datatype;
+    naxes[0] = data.image[IDstream].md[0].size[0];
+    naxes[1] = data.image[IDstream].md[0].size[1];
+    naxes[2] = NBframes;
 
-    create_3Dimage_ID(IDname, xsize, ysize, zsize, &ID);
-    cnt = data.image[IDstream].md[0].cnt0;
+    binmode = 0;
+    if((streamrecord_binx != 1) || (streamrecord_biny != 1) ||
+            (streamrecord_NBcoadd != 1))
+    {
+        if(((uint32_t) streamrecord_binx > naxes[0]) ||
+                ((uint32_t) streamrecord_biny > naxes[1]))
+        {
+            PRINT_ERROR("binning %d x %d larger than %u x %u stream %s",
+                        streamrecord_binx,
+                        streamrecord_biny,
+                        naxes[0],
+                        naxes[1],
+                        streamname);
+            return -1;
+        }
+        binmode  = 1;
+        datatype = _DATATYPE_FLOAT;
+        naxes[0] /= streamrecord_binx;
+        naxes[1] /= streamrecord_biny;
+        nelementout = (uint64_t) naxes[0] * naxes[1];
+        coadd       = (double *) calloc(nelementout, sizeof(double));
+        if(coadd == NULL)
+        {
+            PRINT_ERROR("calloc error");
+            abort();
+        }
+        printf("binning %d x %d, coadding %ld frames -> %u x %u\n",
+               streamrecord_binx,
+               streamrecord_biny,
+               streamrecord_NBcoadd,
+               naxes[0],
+               naxes[1]);
+    }
+    create_image_ID(IDname, 3, naxes, datatype, 0, 0, 0, &ID);
 
-    kk = 0;
+    WRITE_IMAGENAME(IDtiming_name, "%s_timing", IDname);
+    create_2Dimage_ID_double(IDtiming_name, 3, NBframes, &IDtiming);
+
+    image_basic_streamreader_init(&reader, IDstream);
+    if(reader.semindex != -1)
+    {
+        printf("waiting on semaphore %d of stream %s\n",
+               reader.semindex,
+               streamname);
+    }
 
-    ptr = (char *) data.image[ID].array.F;
+    kk        = 0;
+    NBcoadded = 0;
+
+    ptr = (char *) data.image[ID].array.raw;
     while(kk != NBframes)
     {
-        while(cnt > data.image[IDstream].md[0].cnt0)
+        if(image_basic_streamreader_wait(&reader, 1000000) == 0)
         {
-            usleep(waitdelayus);
+            if((data.signal_INT == 1) || (data.signal_TERM == 1))
+            {
+                printf("\nrecording interrupted\n");
+                break;
+            }
+            continue;
+        }
+
+        if(binmode == 0)
+        {
+            image_basic_streamreader_copy(&reader, ptr);
         }
+        else
+        {
+            basic_contract_frame_add(coadd,
+                                     image_basic_streamreader_frame(&reader),
+                                     data.image[IDstream].md[0].datatype,
+                                     data.image[IDstream].md[0].size[0],
+                                     data.image[IDstream].md[0].size[1],
+                                     streamrecord_binx,
+                                     streamrecord_biny);
+            image_basic_streamreader_release(&reader);
+            if(NBcoadded == 0)
+            {
+                data.image[IDtiming].array.D[kk * 3]     = reader.cnt0;
+                data.image[IDtiming].array.D[kk * 3 + 1] =
+                    reader.atime.tv_sec + 1.0e-9 * reader.atime.tv_nsec;
+            }
+            NBcoadded++;
+            if(NBcoadded < streamrecord_NBcoadd)
+            {
+                continue;
+            }
+            for(uint64_t ii = 0; ii < nelementout; ii++)
+            {
+                ((float *) ptr)[ii] = coadd[ii];
+                coadd[ii]           = 0.0;
+            }
+            NBcoadded = 0;
+        }
+        clock_gettime(CLOCK_REALTIME, &ts);
 
-        cnt++;
+        if(binmode == 0)
+        {
+            data.image[IDtiming].array.D[kk * 3]     = reader.cnt0;
+            data.image[IDtiming].array.D[kk * 3 + 1] =
+                reader.atime.tv_sec + 1.0e-9 * reader.atime.tv_nsec;
+        }
+        data.image[IDtiming].array.D[kk * 3 + 2] =
+            ts.tv_sec + 1.0e-9 * ts.tv_nsec;
 
-        printf("\r%ld / %ld  [%ld %ld]      ",
-               kk,
-               NBframes,
-               cnt,
-               data.image[ID].md[0].cnt0);
-        fflush(stdout);
+        if(kk % 100 == 0)
+        {
+            printf("\r%ld / %ld  [%lu]  missed %ld      ",
+                   kk,
+                   NBframes,
+                   (unsigned long) reader.cnt0,
+                   reader.NBmissed);
+            fflush(stdout);
+        }
 
-        memcpy(ptr, data.image[IDstream].array.F, sizeof(float) * xysize);
-        ptr += sizeof(float) * xysize;
+        ptr += (size_t) ImageStreamIO_typesize(datatype) * naxes[0] * naxes[1];
         kk++;
     }
     printf("\n\n");
 
+    free(coadd);
+
+    image_basic_streamreader_report(&reader,
+                                    kk * streamrecord_NBcoadd,
+                                    NBframes * streamrecord_NBcoadd);
+
+    return ID;
+}
+
+// ==========================================
+// Triggered recording
+// ==========================================
+
+static volatile sig_atomic_t streamrecord_trigger_received = 0;
+
+static void streamrecord_trigger_sighandler(int signo)
+{
+    (void) signo;
+    streamrecord_trigger_received = 1;
+}
+
+// returns 1 if any of the nelement frame values exceeds thr
+static int frame_exceeds(const void *frame,
+                         uint64_t    nelement,
+                         uint8_t     datatype,
+                         double      thr)
+{
+#define FRAME_EXCEEDS(type)                                                    \
+    {                                                                          \
+        const type *ptr = (const type *) frame;                                \
+        for(uint64_t ii = 0; ii < nelement; ii++)                              \
+        {                                                                      \
+            if(ptr[ii] > thr)                                                  \
+            {                                                                  \
+                return 1;                                                      \
+            }                                                                  \
+        }                                                                      \
+    }                                                                          \
+    break;
+
+    switch(datatype)
+    {
+        case _DATATYPE_UINT8:
+            FRAME_EXCEEDS(uint8_t)
+        case _DATATYPE_INT8:
+            FRAME_EXCEEDS(int8_t)
+        case _DATATYPE_UINT16:
+            FRAME_EXCEEDS(uint16_t)
+        case _DATATYPE_INT16:
+            FRAME_EXCEEDS(int16_t)
+        case _DATATYPE_UINT32:
+            FRAME_EXCEEDS(uint32_t)
+        case _DATATYPE_INT32:
+            FRAME_EXCEEDS(int32_t)
+        case _DATATYPE_UINT64:
+            FRAME_EXCEEDS(uint64_t)
+        case _DATATYPE_INT64:
+            FRAME_EXCEEDS(int64_t)
+        case _DATATYPE_FLOAT:
+            FRAME_EXCEEDS(float)
+        case _DATATYPE_DOUBLE:
+            FRAME_EXCEEDS(double)
+    }
+#undef FRAME_EXCEEDS
+
+    return 0;
+}
+
+// swap frames k1 and k2, using tmp frame buffer
+static void
+frame_swap(char *ptr, size_t framesize, long k1, long k2, char *tmp)
+{
+    memcpy(tmp, ptr + k1 * framesize, framesize);
+    memcpy(ptr + k1 * framesize, ptr + k2 * framesize, framesize);
+    memcpy(ptr + k2 * framesize, tmp, framesize);
+}
+
+// reverse order of frames k1 to k2 (excluded)
+static void
+frame_reverse(char *ptr, size_t framesize, long k1, long k2, char *tmp)
+{
+    for(k2--; k1 < k2; k1++, k2--)
+    {
+        frame_swap(ptr, framesize, k1, k2, tmp);
+    }
+}
+
+/* send trigger to a process running IMAGE_BASIC_streamrecord_trigger
+ * with "cmd" trigger
+ */
+errno_t IMAGE_BASIC_streamrecord_sendtrigger(long pid)
+{
+    if(kill((pid_t) pid, SIGUSR1) != 0)
+    {
+        PRINT_ERROR("cannot send trigger to process %ld", pid);
+        return RETURN_FAILURE;
+    }
+
+    return RETURN_SUCCESS;
+}
+
+// record frames before and after a trigger
+//
+// Until the trigger fires, frames are written to a ring of NBpre frames
+// held in the output cube itself, so the steady-state cost is one copy per
+// frame. On trigger the ring is frozen and NBpost frames are recorded
+// after it. The ring is then rotated in place into time order : output
+// slices 0 to NBpre-1 are the pre-trigger frames, slice NBpre is the first
+// frame received after the trigger. Timing table <IDname>_timing is
+// written as with IMAGE_BASIC_streamrecord.
+//
+// trigger :
+//   cmd           SIGUSR1 received, see IMAGE_BASIC_streamrecord_sendtrigger
+//   thr:<value>   a pixel of the last frame exceeds value
+//                 (frame is checked after its copy, while in cache)
+//   cnt:<stream>  cnt0 of another stream changes
+//
+imageID IMAGE_BASIC_streamrecord_trigger(const char *__restrict streamname,
+        long NBpre,
+        long NBpost,
+        const char *__restrict IDname,
+        const char *__restrict trigger)
+{
+    imageID                  ID;
+    imageID                  IDtiming;
+    imageID                  IDstream;
+    imageID                  IDtrig   = -1;
+    double                   trigthr  = 0.0;
+    uint64_t                 trigcnt0 = 0;
+    int                      trigmode;
+    uint32_t                 naxes[3];
+    char                     IDtiming_name[STRINGMAXLEN_IMGNAME];
+    IMAGE_BASIC_STREAMREADER reader;
+    struct sigaction         sigact_trig;
+    struct sigaction         sigact_prev;
+    struct timespec          ts;
+    uint8_t                  datatype;
+    uint64_t                 nelement;
+    char                    *ptr;
+    char                    *tmpframe;
+    double                  *tptr;
+    double                   ttmp[3];
+    long                     ringindex = 0;
+    long                     NBring    = 0;
+    long                     NBrecpost = 0;
+    int                      triggered = 0;
+
+    if(NBpre < 1)
+    {
+        PRINT_ERROR("need at least one pre-trigger frame");
+        return -1;
+    }
+    if(NBpost < 0)
+    {
+        PRINT_ERROR("number of post-trigger frames cannot be negative");
+        return -1;
+    }
+
+    IDstream = image_ID(streamname);
+    datatype = data.image[IDstream].md[0].datatype;
+    nelement = (uint64_t) data.image[IDstream].md[0].size[0] *
+               data.image[IDstream].md[0].size[1];
+
+    if(strcmp(trigger, "cmd") == 0)
+    {
+        trigmode = 0;
+    }
+    else if(strncmp(trigger, "thr:", 4) == 0)
+    {
+        trigmode = 1;
+        trigthr  = atof(trigger + 4);
+        if((datatype == _DATATYPE_COMPLEX_FLOAT) ||
+                (datatype == _DATATYPE_COMPLEX_DOUBLE))
+        {
+            PRINT_ERROR("threshold trigger not supported for complex data");
+            return -1;
+        }
+    }
+    else if(strncmp(trigger, "cnt:", 4) == 0)
+    {
+        trigmode = 2;
+        IDtrig   = image_ID(trigger + 4);
+        if(IDtrig == -1)
+        {
+            PRINT_ERROR("trigger stream %s not found", trigger + 4);
+            return -1;
+        }
+        trigcnt0 = data.image[IDtrig].md[0].cnt0;
+    }
+    else
+    {
+        PRINT_ERROR("unknown trigger %s", trigger);
+        return -1;
+    }
+
+    naxes[0] = data.image[IDstream].md[0].size[0];
+    naxes[1] = data.image[IDstream].md[0].size[1];
+    naxes[2] = NBpre + NBpost;
+    create_image_ID(IDname, 3, naxes, datatype, 0, 0, 0, &ID);
+
+    WRITE_IMAGENAME(IDtiming_name, "%s_timing", IDname);
+    create_2Dimage_ID_double(IDtiming_name, 3, NBpre + NBpost, &IDtiming);
+
+    image_basic_streamreader_init(&reader, IDstream);
+
+    streamrecord_trigger_received = 0;
+    if(trigmode == 0)
+    {
+        memset(&sigact_trig, 0, sizeof(struct sigaction));
+        sigact_trig.sa_handler = streamrecord_trigger_sighandler;
+        sigemptyset(&sigact_trig.sa_mask);
+        sigaction(SIGUSR1, &sigact_trig, &sigact_prev);
+        printf("waiting for trigger : imgstreamrecsendtrig %ld\n",
+               (long) getpid());
+    }
+
+    ptr  = (char *) data.image[ID].array.raw;
+    tptr = data.image[IDtiming].array.D;
+    // with NBpost = 0 the loop still runs until the trigger fires
+    while((triggered == 0) || (NBrecpost < NBpost))
+    {
+        char *frameptr;
+        long  slice;
+
+        if(image_basic_streamreader_wait(&reader, 1000000) == 0)
+        {
+            if((data.signal_INT == 1) || (data.signal_TERM == 1))
+            {
+                printf("\nrecording interrupted\n");
+                break;
+            }
+            continue;
+        }
+
+        if(triggered == 0)
+        {
+            slice = ringindex;
+        }
+        else
+        {
+            slice = NBpre + NBrecpost;
+        }
+        frameptr = ptr + slice * reader.framesize;
+        image_basic_streamreader_copy(&reader, frameptr);
+        clock_gettime(CLOCK_REALTIME, &ts);
+        tptr[slice * 3]     = reader.cnt0;
+        tptr[slice * 3 + 1] = reader.atime.tv_sec +
+                              1.0e-9 * reader.atime.tv_nsec;
+        tptr[slice * 3 + 2] = ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+
+        if(triggered == 1)
+        {
+            NBrecpost++;
+            continue;
+        }
+
+        ringindex++;
+        if(ringindex == NBpre)
+        {
+            ringindex = 0;
+        }
+        if(NBring < NBpre)
+        {
+            NBring++;
+        }
+
+        switch(trigmode)
+        {
+            case 0:
+                triggered = streamrecord_trigger_received;
+                break;
+            case 1:
+                triggered =
+                    frame_exceeds(frameptr, nelement, datatype, trigthr);
+                break;
+            case 2:
+                triggered = (data.image[IDtrig].md[0].cnt0 != trigcnt0);
+                break;
+        }
+        if(triggered == 1)
+        {
+            printf("trigger at cnt0 = %lu, %ld pre-trigger frames\n",
+                   (unsigned long) reader.cnt0,
+                   NBring);
+        }
+    }
+
+    if(trigmode == 0)
+    {
+        sigaction(SIGUSR1, &sigact_prev, NULL);
+    }
+
+    // put ring in time order, oldest frame first
+    tmpframe = (char *) malloc(reader.framesize);
+    if(tmpframe == NULL)
+    {
+        PRINT_ERROR("malloc returns NULL pointer");
+        abort();
+    }
+    if(NBring == NBpre)
+    {
+        frame_reverse(ptr, reader.framesize, 0, ringindex, tmpframe);
+        frame_reverse(ptr, reader.framesize, ringindex, NBpre, tmpframe);
+        frame_reverse(ptr, reader.framesize, 0, NBpre, tmpframe);
+        frame_reverse((char *) tptr,
+                      sizeof(ttmp),
+                      0,
+                      ringindex,
+                      (char *) ttmp);
+        frame_reverse((char *) tptr,
+                      sizeof(ttmp),
+                      ringindex,
+                      NBpre,
+                      (char *) ttmp);
+        frame_reverse((char *) tptr, sizeof(ttmp), 0, NBpre, (char *) ttmp);
+    }
+    else
+    {
+        // ring not filled : move frames next to post-trigger frames
+        memmove(ptr + (NBpre - NBring) * reader.framesize,
+                ptr,
+                NBring * reader.framesize);
+        memset(ptr, 0, (NBpre - NBring) * reader.framesize);
+        memmove(tptr + 3 * (NBpre - NBring), tptr, sizeof(ttmp) * NBring);
+        memset(tptr, 0, sizeof(ttmp) * (NBpre - NBring));
+    }
+    free(tmpframe);
+
+    printf("\n");
+    image_basic_streamreader_report(&reader,
+                                    NBring + NBrecpost,
+                                    NBring + NBpost);
+
     return ID;
 }
+
+// ==========================================
+// Multi-stream recording
+// ==========================================
+
+typedef struct
+{
+    imageID                  IDstream;
+    imageID                  ID;       // output cube
+    imageID                  IDtiming; // output timing table
+    long                     NBframes;
+    long                     NBrecorded; // atomic, read by monitor loop
+    IMAGE_BASIC_STREAMREADER reader;
+    int                     *stop; // atomic, set when recording must end
+    int                      master;
+} STREAMRECORD_THREAD;
+
+// one recording thread per stream
+static void *streamrecord_multi_thread(void *ptr)
+{
+    STREAMRECORD_THREAD *thd = (STREAMRECORD_THREAD *) ptr;
+    struct timespec      ts;
+    char                *frameptr;
+    long                 kk;
+
+    frameptr = (char *) data.image[thd->ID].array.raw;
+    kk       = 0;
+    while((kk != thd->NBframes) &&
+            (__atomic_load_n(thd->stop, __ATOMIC_ACQUIRE) == 0))
+    {
+        // short timeout so that stop requests are seen quickly
+        if(image_basic_streamreader_wait(&thd->reader, 100000) == 0)
+        {
+            continue;
+        }
+
+        image_basic_streamreader_copy(&thd->reader, frameptr);
+        clock_gettime(CLOCK_REALTIME, &ts);
+
+        data.image[thd->IDtiming].array.D[kk * 3] = thd->reader.cnt0;
+        data.image[thd->IDtiming].array.D[kk * 3 + 1] =
+            thd->reader.atime.tv_sec + 1.0e-9 * thd->reader.atime.tv_nsec;
+        data.image[thd->IDtiming].array.D[kk * 3 + 2] =
+            ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+
+        frameptr += thd->reader.framesize;
+        kk++;
+        __atomic_store_n(&thd->NBrecorded, kk, __ATOMIC_RELEASE);
+    }
+
+    if(thd->master == 1)
+    {
+        __atomic_store_n(thd->stop, 1, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+// index table row : stream, cnt0, acquisition time, receive time
+typedef struct
+{
+    double stream;
+    double cnt0;
+    double atime;
+    double rtime;
+} STREAMRECORD_INDEX;
+
+static int streamrecord_index_cmp(const void *a, const void *b)
+{
+    double ta = ((const STREAMRECORD_INDEX *) a)->rtime;
+    double tb = ((const STREAMRECORD_INDEX *) b)->rtime;
+
+    return (ta > tb) - (ta < tb);
+}
+
+// record several streams simultaneously, one thread per stream
+//
+// streamnames : comma-separated list of streams
+//
+// Stream i is recorded into cube <IDprefix>_<stream i> with its timing
+// table <IDprefix>_<stream i>_timing, same format as imgstreamrec.
+// Recording stops when the first stream of the list has NBframes frames
+// (or on SIGINT/SIGTERM); other streams record up to NBframes frames
+// meanwhile, remaining slices stay at zero.
+//
+// All frames are then merged, sorted by receive time, into index table
+// <IDprefix>_index, size 4 x NBtotal (double) :
+//   stream index, cnt0, stream acquisition time [s], receive time [s]
+// Receive times of all streams share the CLOCK_REALTIME time base of this
+// process, so the cubes can be cross-matched from the index.
+//
+// returns ID of index table
+imageID IMAGE_BASIC_streamrecord_multi(const char *__restrict streamnames,
+                                       long NBframes,
+                                       const char *__restrict IDprefix)
+{
+    STREAMRECORD_THREAD thd[STREAMRECORD_MULTI_MAXSTREAM];
+    pthread_t           thread[STREAMRECORD_MULTI_MAXSTREAM];
+    char                streamlist[STRINGMAXLEN_FILENAME];
+    char               *streamname[STREAMRECORD_MULTI_MAXSTREAM];
+    char               *saveptr;
+    char               *tok;
+    char                IDname[STRINGMAXLEN_IMGNAME];
+    uint32_t            naxes[3];
+    int                 NBstream;
+    int                 NBstarted;
+    int                 stop = 0;
+    imageID             IDindex;
+    long                NBtotal;
+    long                kk;
+    STREAMRECORD_INDEX *index;
+
+    strncpy(streamlist, streamnames, STRINGMAXLEN_FILENAME - 1);
+    streamlist[STRINGMAXLEN_FILENAME - 1] = '\0';
+    NBstream = 0;
+    tok      = strtok_r(streamlist, ",", &saveptr);
+    while(tok != NULL)
+    {
+        if(NBstream == STREAMRECORD_MULTI_MAXSTREAM)
+        {
+            printf("ERROR: more than %d streams\n",
+                   STREAMRECORD_MULTI_MAXSTREAM);
+            return -1;
+        }
+        streamname[NBstream] = tok;
+        NBstream++;
+        tok = strtok_r(NULL, ",", &saveptr);
+    }
+    if(NBstream == 0)
+    {
+        printf("ERROR: no stream in list \"%s\"\n", streamnames);
+        return -1;
+    }
+
+    for(int st = 0; st < NBstream; st++)
+    {
+        thd[st].IDstream = image_ID(streamname[st]);
+        if(thd[st].IDstream == -1)
+        {
+            printf("ERROR: stream %s not found\n", streamname[st]);
+            return -1;
+        }
+    }
+
+    for(int st = 0; st < NBstream; st++)
+    {
+        imageID IDstream = thd[st].IDstream;
+
+        naxes[0] = data.image[IDstream].md[0].size[0];
+        naxes[1] = data.image[IDstream].md[0].size[1];
+        naxes[2] = NBframes;
+        WRITE_IMAGENAME(IDname, "%s_%s", IDprefix, streamname[st]);
+        create_image_ID(IDname,
+                        3,
+                        naxes,
+                        data.image[IDstream].md[0].datatype,
+                        0,
+                        0,
+                        0,
+                        &thd[st].ID);
+        WRITE_IMAGENAME(IDname, "%s_%s_timing", IDprefix, streamname[st]);
+        create_2Dimage_ID_double(IDname, 3, NBframes, &thd[st].IDtiming);
+
+        thd[st].NBframes   = NBframes;
+        thd[st].NBrecorded = 0;
+        thd[st].stop       = &stop;
+        thd[st].master     = (st == 0) ? 1 : 0;
+    }
+
+    // readers are set up before any thread starts, so that recordings
+    // begin together
+    for(int st = 0; st < NBstream; st++)
+    {
+        image_basic_streamreader_init(&thd[st].reader, thd[st].IDstream);
+    }
+    for(NBstarted = 0; NBstarted < NBstream; NBstarted++)
+    {
+        if(pthread_create(&thread[NBstarted],
+                          NULL,
+                          streamrecord_multi_thread,
+                          (void *) &thd[NBstarted]) != 0)
+        {
+            PRINT_ERROR("pthread_create error");
+            __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+
+    while(__atomic_load_n(&stop, __ATOMIC_ACQUIRE) == 0)
+    {
+        if((data.signal_INT == 1) || (data.signal_TERM == 1))
+        {
+            printf("\nrecording interrupted\n");
+            __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+            break;
+        }
+        printf("\r%ld / %ld   ",
+               __atomic_load_n(&thd[0].NBrecorded, __ATOMIC_ACQUIRE),
+               NBframes);
+        fflush(stdout);
+        usleep(100000);
+    }
+    for(int st = 0; st < NBstarted; st++)
+    {
+        pthread_join(thread[st], NULL);
+    }
+    printf("\n");
+    if(NBstarted < NBstream)
+    {
+        return -1;
+    }
+
+    NBtotal = 0;
+    for(int st = 0; st < NBstream; st++)
+    {
+        printf("%-20s ", streamname[st]);
+        image_basic_streamreader_report(&thd[st].reader,
+                                        thd[st].NBrecorded,
+                                        NBframes);
+        NBtotal += thd[st].NBrecorded;
+    }
+
+    index = (STREAMRECORD_INDEX *) malloc(sizeof(STREAMRECORD_INDEX) *
+                                          (NBtotal + 1));
+    if(index == NULL)
+    {
+        PRINT_ERROR("malloc error");
+        abort();
+    }
+    kk = 0;
+    for(int st = 0; st < NBstream; st++)
+    {
+        double *timing = data.image[thd[st].IDtiming].array.D;
+
+        for(long k = 0; k < thd[st].NBrecorded; k++)
+        {
+            index[kk].stream = st;
+            index[kk].cnt0   = timing[k * 3];
+            index[kk].atime  = timing[k * 3 + 1];
+            index[kk].rtime  = timing[k * 3 + 2];
+            kk++;
+        }
+    }
+    qsort(index, NBtotal, sizeof(STREAMRECORD_INDEX), streamrecord_index_cmp);
+
+    WRITE_IMAGENAME(IDname, "%s_index", IDprefix);
+    create_2Dimage_ID_double(IDname, 4, (NBtotal > 0) ? NBtotal : 1, &IDindex);
+    memcpy(data.image[IDindex].array.D,
+           index,
+           sizeof(STREAMRECORD_INDEX) * NBtotal);
+    free(index);
+
+    printf("%ld frames from %d streams indexed in %s\n",
+           NBtotal,
+           NBstream,
+           IDname);
+
+    return IDindex;
+}
@@ -1,8 +1,56 @@
 /** @file streamrecord.h
  */
 
+#ifndef _IMAGE_BASIC_STREAMRECORD_H
+#define _IMAGE_BASIC_STREAMRECORD_H
+
+// reads consecutive frames of a stream, counting lost frames
+typedef struct
+{
+    imageID         IDstream;
+    size_t          framesize; // bytes
+    int             semindex;  // -1 if polling cnt0
+    uint64_t        cnt0;      // cnt0 of current frame
+    struct timespec atime;     // acquisition time of current frame
+    long            NBmissed;  // frames skipped between waits
+    long            NBtorn;    // frames updated while being read
+} IMAGE_BASIC_STREAMREADER;
+
 errno_t __attribute__((cold)) streamrecord_addCLIcmd();
 
+errno_t image_basic_streamreader_init(IMAGE_BASIC_STREAMREADER *reader,
+                                      imageID IDstream);
+
+int image_basic_streamreader_wait(IMAGE_BASIC_STREAMREADER *reader,
+                                  long timeout_us);
+
+const void *image_basic_streamreader_frame(IMAGE_BASIC_STREAMREADER *reader);
+
+int image_basic_streamreader_release(IMAGE_BASIC_STREAMREADER *reader);
+
+void image_basic_streamreader_copy(IMAGE_BASIC_STREAMREADER *reader,
+                                   void *dest);
+
+void image_basic_streamreader_report(const IMAGE_BASIC_STREAMREADER *reader,
+                                     long NBframes,
+                                     long NBframes_requested);
+
 imageID IMAGE_BASIC_streamrecord(const char *__restrict streamname,
                                  long NBframes,
                                  const char *__restrict IDname);
+
+imageID IMAGE_BASIC_streamrecord_trigger(const char *__restrict streamname,
+        long NBpre,
+        long NBpost,
+        const char *__restrict IDname,
+        const char *__restrict trigger);
+
+errno_t IMAGE_BASIC_streamrecord_sendtrigger(long pid);
+
+errno_t IMAGE_BASIC_streamrecord_setbinning(int binx, int biny, long NBcoadd);
+
+imageID IMAGE_BASIC_streamrecord_multi(const char *__restrict streamnames,
+                                       long NBframes,
+                                       const char *__restrict IDprefix);
+
+#endif
@@ -0,0 +1,186 @@
+/** @file streamtiming.c
+ *
+ * Timing helpers shared by the stream feed/record functions :
+ * absolute-deadline sleep and wake-up jitter histogram
+ */
+
+#include <math.h>
+#include <time.h>
+
+#include "CommandLineInterface/CLIcore.h"
+
+#include "COREMOD_memory/COREMOD_memory.h"
+
+#include "streamtiming.h"
+
+int64_t image_basic_timespec_diff_ns(const struct timespec *t0,
+                                     const struct timespec *t1)
+{
+    return (int64_t)(t1->tv_sec - t0->tv_sec) * 1000000000L +
+           (int64_t)(t1->tv_nsec - t0->tv_nsec);
+}
+
+void image_basic_timespec_add_ns(struct timespec *t, int64_t dt_ns)
+{
+    int64_t nsec = t->tv_nsec + dt_ns % 1000000000L;
+
+    t->tv_sec += dt_ns / 1000000000L;
+    if(nsec >= 1000000000L)
+    {
+        nsec -= 1000000000L;
+        t->tv_sec++;
+    }
+    else if(nsec < 0)
+    {
+        nsec += 1000000000L;
+        t->tv_sec--;
+    }
+    t->tv_nsec = nsec;
+}
+
+/* sleep until absolute CLOCK_MONOTONIC deadline
+ * the last spin_ns before the deadline are spent busy-waiting,
+ * which removes the scheduler wake-up latency from the jitter
+ */
+void image_basic_sleep_until(const struct timespec *deadline, long spin_ns)
+{
+    struct timespec tsleep = *deadline;
+    struct timespec tnow;
+
+    if(spin_ns > 0)
+    {
+        image_basic_timespec_add_ns(&tsleep, -spin_ns);
+    }
+
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tsleep, NULL) ==
+            EINTR)
+    {
+        // signal received : the caller checks its signal flags
+        if((data.signal_INT == 1) || (data.signal_TERM == 1))
+        {
+            return;
+        }
+    }
+
+    if(spin_ns > 0)
+    {
+        do
+        {
+            clock_gettime(CLOCK_MONOTONIC, &tnow);
+        }
+        while(image_basic_timespec_diff_ns(&tnow, deadline) > 0);
+    }
+}
+
+void image_basic_jitterhist_init(IMAGE_BASIC_JITTERHIST *hist)
+{
+    memset(hist, 0, sizeof(IMAGE_BASIC_JITTERHIST));
+    hist->min_ns = INT64_MAX;
+    hist->max_ns = INT64_MIN;
+}
+
+void image_basic_jitterhist_add(IMAGE_BASIC_JITTERHIST *hist, int64_t dt_ns)
+{
+    long bin = dt_ns / 1000;
+
+    if(bin < 0)
+    {
+        bin = 0;
+    }
+    if(bin > IMAGE_BASIC_JITTERHIST_NBBIN)
+    {
+        bin = IMAGE_BASIC_JITTERHIST_NBBIN;
+    }
+    hist->cnt[bin]++;
+
+    hist->NBsample++;
+    if(dt_ns < hist->min_ns)
+    {
+        hist->min_ns = dt_ns;
+    }
+    if(dt_ns > hist->max_ns)
+    {
+        hist->max_ns = dt_ns;
+    }
+    hist->sum_ns += (double) dt_ns;
+    hist->sum2_ns += (double) dt_ns * dt_ns;
+}
+
+// upper edge of the bin containing fraction frac of the samples [us]
+long image_basic_jitterhist_percentile_us(const IMAGE_BASIC_JITTERHIST *hist,
+        double frac)
+{
+    uint64_t cntlim = (uint64_t)(frac * hist->NBsample);
+    uint64_t cnt    = 0;
+
+    if(hist->NBsample == 0)
+    {
+        return 0;
+    }
+
+    for(long bin = 0; bin <= IMAGE_BASIC_JITTERHIST_NBBIN; bin++)
+    {
+        cnt += hist->cnt[bin];
+        if(cnt > cntlim)
+        {
+            return bin + 1;
+        }
+    }
+
+    return IMAGE_BASIC_JITTERHIST_NBBIN + 1;
+}
+
+void image_basic_jitterhist_print(const IMAGE_BASIC_JITTERHIST *hist,
+                                  const char *label)
+{
+    double ave, var, rms;
+
+    if(hist->NBsample == 0)
+    {
+        printf("%s : no sample\n", label);
+        return;
+    }
+
+    ave = hist->sum_ns / hist->NBsample;
+    // rounding can make the variance of near-constant samples negative
+    var = hist->sum2_ns / hist->NBsample - ave * ave;
+    if(var < 0.0)
+    {
+        var = 0.0;
+    }
+    rms = sqrt(var);
+
+    printf("%s : %lu samples\n", label, (unsigned long) hist->NBsample);
+    printf("    ave = %9.3f us   rms = %9.3f us\n",
+           1.0e-3 * ave,
+           1.0e-3 * rms);
+    printf("    min = %9.3f us   max = %9.3f us\n",
+           1.0e-3 * hist->min_ns,
+           1.0e-3 * hist->max_ns);
+    printf("    p50 < %ld us  p90 < %ld us  p99 < %ld us  p99.9 < %ld us\n",
+           image_basic_jitterhist_percentile_us(hist, 0.5),
+           image_basic_jitterhist_percentile_us(hist, 0.9),
+           image_basic_jitterhist_percentile_us(hist, 0.99),
+           image_basic_jitterhist_percentile_us(hist, 0.999));
+    if(hist->cnt[IMAGE_BASIC_JITTERHIST_NBBIN] > 0)
+    {
+        printf("    %lu samples > %d us\n",
+               (unsigned long) hist->cnt[IMAGE_BASIC_JITTERHIST_NBBIN],
+               IMAGE_BASIC_JITTERHIST_NBBIN);
+    }
+}
+
+// write histogram counts to 2D image, size (NBBIN+1) x 1
+imageID image_basic_jitterhist_to_image(const IMAGE_BASIC_JITTERHIST *hist,
+                                        const char *IDname)
+{
+    imageID ID;
+
+    create_2Dimage_ID(IDname, IMAGE_BASIC_JITTERHIST_NBBIN + 1, 1, &ID);
+    for(long bin = 0; bin <= IMAGE_BASIC_JITTERHIST_NBBIN; bin++)
+    {
+        data.image[ID].array.F[bin] = (float) hist->cnt[bin];
+    }
+
+    return ID;
+}
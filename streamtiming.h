@@ -0,0 +1,43 @@
+/** @file streamtiming.h
+ */
+
+#ifndef _IMAGE_BASIC_STREAMTIMING_H
+#define _IMAGE_BASIC_STREAMTIMING_H
+
+#include <stdint.h>
+#include <time.h>
+
+// jitter histogram : 1 us bins, last bin collects overflows
+#define IMAGE_BASIC_JITTERHIST_NBBIN 1000
+
+typedef struct
+{
+    uint64_t cnt[IMAGE_BASIC_JITTERHIST_NBBIN + 1];
+    uint64_t NBsample;
+    int64_t  min_ns;
+    int64_t  max_ns;
+    double   sum_ns;
+    double   sum2_ns;
+} IMAGE_BASIC_JITTERHIST;
+
+int64_t image_basic_timespec_diff_ns(const struct timespec *t0,
+                                     const struct timespec *t1);
+
+void image_basic_timespec_add_ns(struct timespec *t, int64_t dt_ns);
+
+void image_basic_sleep_until(const struct timespec *deadline, long spin_ns);
+
+void image_basic_jitterhist_init(IMAGE_BASIC_JITTERHIST *hist);
+
+void image_basic_jitterhist_add(IMAGE_BASIC_JITTERHIST *hist, int64_t dt_ns);
+
+long image_basic_jitterhist_percentile_us(const IMAGE_BASIC_JITTERHIST *hist,
+        double frac);
+
+void image_basic_jitterhist_print(const IMAGE_BASIC_JITTERHIST *hist,
+                                  const char *label);
+
+imageID image_basic_jitterhist_to_image(const IMAGE_BASIC_JITTERHIST *hist,
+                                        const char *IDname);
+
+#endif